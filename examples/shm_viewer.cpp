@@ -0,0 +1,80 @@
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "FluidRenderer.hpp"
+#include "WindowConfig.hpp"
+#include "WindowManager.hpp"
+#include "colour.hpp"
+#include "shm_ring.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// shows the mid z slice of the frames a running fluidsim publishes to
+// shared memory; the solver never waits for this process
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    std::cerr << "usage: shm_viewer <name printed by fluidsim>\n";
+    return 1;
+  }
+  const std::string name = argv[1];
+
+  try {
+    const ShmRingReader frames(name);
+    const Grid3D grid = frames.grid();
+
+    const WindowConfig config{1024, 768, "fluidsim viewer"};
+    WindowManager window(config);
+    const Colour windowColour{0.2F, 0.3F, 0.3F, 1.0F};
+
+    // one plane, so the renderer's mid slice is the slice copied out
+    Grid3D slice(grid.nx, grid.ny, 1);
+    FluidRenderer renderer(slice);
+    std::vector<Vec3> velocity(slice.cellCount());
+    uint64_t shown = 0;
+
+    while (!window.shouldClose()) {
+      if (glfwGetKey(WindowManager::getGLFWwindow(), GLFW_KEY_ESCAPE) ==
+          GLFW_PRESS) {
+        glfwSetWindowShouldClose(WindowManager::getGLFWwindow(), 1);
+      }
+
+      if (frames.published() != shown) {
+        uint64_t copied = 0;
+        const bool complete = frames.readLatest([&](const ShmFrameView& f) {
+          copied = f.frame + 1;
+          for (size_t y = 0; y < grid.ny; ++y) {
+            for (size_t x = 0; x < grid.nx; ++x) {
+              velocity[slice.offset(x, y, 0)] =
+                  f.velocity[grid.offset(x, y, grid.nz / 2)];
+            }
+          }
+        });
+        // a torn copy is dropped; the next pass picks up a newer frame
+        if (complete) {
+          renderer.updateSlice(velocity.data(), slice);
+          shown = copied;
+        }
+      }
+
+      glClearColor(windowColour.r, windowColour.g, windowColour.b,
+                   windowColour.a);
+      glClear(GL_COLOR_BUFFER_BIT);
+      renderer.draw();
+
+      window.swapBuffers();
+      WindowManager::pollEvents();
+    }
+  } catch (const std::exception& error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+
+  glfwTerminate();
+  return 0;
+}
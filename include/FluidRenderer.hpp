@@ -2,7 +2,10 @@
 
 #include "RenderPipeline.hpp"
 #include "liquid.hpp"
+#include "snapshot.hpp"
+#include "vec3.hpp"
 #include "vector_math.hpp"
+#include <vector>
 
 class FluidRenderer {
  private:
@@ -10,9 +13,17 @@ class FluidRenderer {
   GLuint textureID = 0;
   size_t sliceZ;
 
+  void uploadSlice(const std::vector<float>& sliceArray,
+                   const Grid3D& grid) const;
+
  public:
   explicit FluidRenderer(Grid3D& grid);
   void updateSlice(const Liquid& fluid, Grid3D& grid) const;
+  // reads a frozen step, so it can run while the solver works on the next
+  void updateSlice(const LiquidSnapshot& snapshot) const;
+  // velocity in grid storage order, held by someone else, e.g. a frame in
+  // shared memory
+  void updateSlice(const Vec3* velocity, const Grid3D& grid) const;
   void draw();
   ~FluidRenderer();
 };
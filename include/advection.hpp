@@ -0,0 +1,143 @@
+#pragma once
+
+#include "cubic_sampler.hpp"
+#include "field.hpp"
+#include "slab_streamer.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <cstddef>
+#include <cstdint>
+
+enum class AdvectionScheme : uint8_t {
+  SemiLagrangian,  // first order, stable at any timestep but diffusive
+  MacCormack       // forward/backward error correction with a min/max limiter
+};
+
+enum class BacktraceOrder : uint8_t {
+  Euler,     // one velocity sample, straight line back
+  Midpoint,  // second order, samples the velocity halfway along the path
+  RK3        // third order (Ralston), three samples along the path
+};
+
+enum class Interpolation : uint8_t {
+  Trilinear,     // eight samples; smears sharp features over a few steps
+  MonotoneCubic  // clamped catmull-rom over 64 samples, see cubic_sampler.hpp
+};
+
+template <typename Grid, typename T>
+T interpolate(const Grid& grid, const Field<T>& field,
+              const SamplePoint& sample, Interpolation interpolation) {
+  if (interpolation == Interpolation::MonotoneCubic) {
+    return monotoneCubicInterpolate(grid, field, sample);
+  }
+  return trilinearInterpolate(grid, field, sample);
+}
+
+// position of a cell in the coordinates trilinearInterpolate samples, where
+// integer coordinates are cell centres
+inline Vec3 cellPosition(size_t x, size_t y, size_t z) {
+  return {static_cast<float>(x), static_cast<float>(y),
+          static_cast<float>(z)};
+}
+
+// where a particle at pos came from timeStep ago; higher orders follow
+// curved streamlines, which keeps swirling flows accurate at larger steps
+template <typename Grid, typename VelT>
+Vec3 tracePosition(const Grid& grid, const Field<VelT>& velocityField,
+                   const Vec3& pos, const VelT& velocityAtPos, float timeStep,
+                   BacktraceOrder order) {
+  constexpr float HALF = 0.5F;
+  constexpr float THREE_QUARTERS = 0.75F;
+  constexpr float RK3_WEIGHT_1 = 2.0F / 9.0F;
+  constexpr float RK3_WEIGHT_2 = 3.0F / 9.0F;
+  constexpr float RK3_WEIGHT_3 = 4.0F / 9.0F;
+
+  switch (order) {
+    case BacktraceOrder::Midpoint: {
+      const Vec3 mid = pos - velocityAtPos * (HALF * timeStep);
+      return pos - trilinearInterpolate(grid, velocityField, mid) * timeStep;
+    }
+    case BacktraceOrder::RK3: {
+      const Vec3 k1 = velocityAtPos;
+      const Vec3 k2 = trilinearInterpolate(grid, velocityField,
+                                           pos - k1 * (HALF * timeStep));
+      const Vec3 k3 = trilinearInterpolate(
+          grid, velocityField, pos - k2 * (THREE_QUARTERS * timeStep));
+      return pos - (k1 * RK3_WEIGHT_1 + k2 * RK3_WEIGHT_2 +
+                    k3 * RK3_WEIGHT_3) *
+                       timeStep;
+    }
+    case BacktraceOrder::Euler:
+    default:
+      return pos - velocityAtPos * timeStep;
+  }
+}
+
+// caches where each cell's trace along the velocity lands; a negative
+// timeStep traces forward instead of back
+template <typename VelT>
+void computeBacktrace(Grid3D& grid, const Field<VelT>& velocityField,
+                      float timeStep, Field<SamplePoint>& samples,
+                      BacktraceOrder order = BacktraceOrder::Euler) {
+  SlabStreamer streamer(grid, samples.get_allocator().slabDepth());
+  streamer.track(velocityField).track(samples);
+
+  withLayout(grid, [&](const auto& cells) {
+    parallelForEachCell(grid, streamer, [&](size_t x, size_t y, size_t z) {
+      const size_t index = cells.offset(x, y, z);
+      samples[index] = samplePoint(
+          tracePosition(cells, velocityField, cellPosition(x, y, z),
+                        velocityField[index], timeStep, order));
+    });
+  });
+}
+
+// dst is src sampled along the cached traces; src and dst must be different
+// fields, so cells can be updated in any order and on any thread
+template <typename T>
+void applyBacktrace(Grid3D& grid, const Field<SamplePoint>& samples,
+                    const Field<T>& src, Field<T>& dst,
+                    Interpolation interpolation = Interpolation::Trilinear) {
+  SlabStreamer streamer(grid, dst.get_allocator().slabDepth());
+  streamer.track(samples).track(src).track(dst);
+
+  withLayout(grid, [&](const auto& cells) {
+    parallelForEachCell(grid, streamer, [&](size_t x, size_t y, size_t z) {
+      const size_t index = cells.offset(x, y, z);
+      dst[index] = interpolate(cells, src, samples[index], interpolation);
+    });
+  });
+}
+
+// advects forward, back again, and uses half the round-trip error to correct
+// the forward result; the correction is clamped to the values the forward
+// step interpolated between, which keeps the scheme free of new extrema
+template <typename T>
+void applyMacCormack(Grid3D& grid, const Field<SamplePoint>& backtrace,
+                     const Field<SamplePoint>& forwardTrace, Field<T>& field,
+                     Field<T>& forward, Field<T>& corrected,
+                     Interpolation interpolation = Interpolation::Trilinear) {
+  constexpr float HALF = 0.5F;
+
+  applyBacktrace(grid, backtrace, field, forward, interpolation);
+  applyBacktrace(grid, forwardTrace, forward, corrected, interpolation);
+
+  SlabStreamer streamer(grid, field.get_allocator().slabDepth());
+  streamer.track(backtrace).track(field).track(forward).track(corrected);
+
+  withLayout(grid, [&](const auto& cells) {
+    parallelForEachCell(grid, streamer, [&](size_t x, size_t y, size_t z) {
+      const size_t index = cells.offset(x, y, z);
+
+      T lower{};
+      T upper{};
+      trilinearBounds(cells, field, backtrace[index], lower, upper);
+
+      const T estimate =
+          forward[index] + HALF * (field[index] - corrected[index]);
+      corrected[index] = componentClamp(estimate, lower, upper);
+    });
+  });
+
+  field.swap(corrected);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "field.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// error-bounded compression of whole grid fields in the spirit of zfp:
+// values are quantised to bins of twice the tolerance, each 4^3 block of
+// bins goes through a reversible integer lifting transform, and the
+// coefficients are packed at the bit width the block needs. Quantising
+// first keeps every value within tolerance regardless of the transform.
+// Layers of blocks are independent chunks, encoded and decoded in
+// parallel. A tolerance of zero, or values the quantiser cannot represent,
+// fall back to the lossless codec. When field holds residuals that the
+// reader adds to values of up to base, the bins narrow to cover the float
+// rounding of that sum too
+std::vector<uint8_t> compressBlocks(const Grid3D& grid,
+                                    const Field<float>& field,
+                                    float tolerance, float base = 0.0F);
+void decompressBlocks(const Grid3D& grid, const std::vector<uint8_t>& encoded,
+                      Field<float>& field);
+
+// the three components are compressed as separate scalar streams
+std::vector<uint8_t> compressBlocks(const Grid3D& grid,
+                                    const Field<Vec3>& field,
+                                    float tolerance, float base = 0.0F);
+void decompressBlocks(const Grid3D& grid, const std::vector<uint8_t>& encoded,
+                      Field<Vec3>& field);
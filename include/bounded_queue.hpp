@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// blocking producer/consumer queue with a fixed capacity
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t maxItems) : capacity(maxItems) {}
+
+  // blocks while the queue is full; returns false once it is closed
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+    if (closed) return false;
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  // never blocks; returns false when the queue is full or closed
+  bool tryPush(T item) {
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (closed || items.size() >= capacity) return false;
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  // blocks while the queue is empty; returns nothing once it is closed and
+  // drained
+  std::optional<T> pop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+    if (items.empty()) return std::nullopt;
+    T item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return item;
+  }
+
+  // wakes every waiter; items already queued can still be popped
+  void close() {
+    const std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+
+  [[nodiscard]] size_t size() const {
+    const std::lock_guard<std::mutex> lock(mutex);
+    return items.size();
+  }
+
+  // a full queue stays full only until a consumer pops, so this is a hint
+  // unless the caller is the only producer
+  [[nodiscard]] bool full() const {
+    const std::lock_guard<std::mutex> lock(mutex);
+    return items.size() >= capacity;
+  }
+
+ private:
+  size_t capacity;
+  bool closed = false;
+  std::deque<T> items;
+  mutable std::mutex mutex;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include "liquid.hpp"
+#include "vector_math.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+constexpr size_t CHECKPOINT_ALIGNMENT = 64;
+
+// first 64 bytes of a checkpoint; fieldCount descriptors follow, then the
+// field payloads, each starting on a 64-byte boundary. Everything is
+// written in host byte order, so checkpoints only move between machines of
+// the same endianness
+struct CheckpointHeader {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t fieldCount;
+  uint64_t nx, ny, nz;
+  uint64_t step;
+  float timeStep;
+  float viscosity;
+  float diffusionRate;
+  uint8_t layout;
+  uint8_t velocityLayout;
+  uint8_t densityRefinement;
+  uint8_t reserved;
+};
+
+struct CheckpointField {
+  std::array<char, 40> name;  // nul terminated
+  uint32_t elementSize;
+  uint32_t reserved;
+  uint64_t elementCount;
+  uint64_t offset;  // from the start of the file
+};
+
+static_assert(sizeof(CheckpointHeader) == CHECKPOINT_ALIGNMENT);
+static_assert(sizeof(CheckpointField) == CHECKPOINT_ALIGNMENT);
+
+// writes every buffer to fd, resuming after short writes; buffers are
+// consumed as they go
+void writeAll(int fd, std::vector<iovec>& buffers);
+
+// writes every persistent field of the fluid with one vectored write to a
+// temporary file, renamed over path once complete
+void writeCheckpoint(const std::string& path, const Grid3D& grid,
+                     const Liquid& fluid, uint64_t step, float timeStep);
+
+// read-only mapping of a checkpoint; descriptors and payloads are used in
+// place, so opening costs one mmap regardless of the state's size
+class CheckpointView {
+ public:
+  explicit CheckpointView(const std::string& path);
+  ~CheckpointView();
+
+  CheckpointView(const CheckpointView&) = delete;
+  CheckpointView& operator=(const CheckpointView&) = delete;
+  CheckpointView(CheckpointView&&) = delete;
+  CheckpointView& operator=(CheckpointView&&) = delete;
+
+  [[nodiscard]] const CheckpointHeader& header() const;
+  [[nodiscard]] Grid3D grid() const;
+  [[nodiscard]] size_t fieldCount() const { return header().fieldCount; }
+  [[nodiscard]] const CheckpointField& field(size_t index) const;
+  // nullptr when the checkpoint has no field of that name
+  [[nodiscard]] const CheckpointField* find(const std::string& name) const;
+  [[nodiscard]] const void* payload(const CheckpointField& field) const;
+  [[nodiscard]] const std::string& path() const { return source; }
+
+ private:
+  std::string source;
+  void* data = nullptr;
+  size_t length = 0;
+};
+
+// adopts a checkpoint into a fluid built on the same grid, first enabling
+// the staggered velocity, refined density and passive scalars it was
+// saved with. Each persistent field becomes a copy-on-write mapping of its
+// payload, so restoring reads nothing up front and untouched pages are
+// never copied. The file must not be truncated while the fluid lives;
+// writeCheckpoint replaces files by rename, so saving over it is safe
+void restoreCheckpoint(const CheckpointView& view, const Grid3D& grid,
+                       Liquid& fluid);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// lossless: the bytes of each element are regrouped into planes, so slowly
+// varying values produce long runs, which are then run-length coded
+std::vector<uint8_t> encodeBytes(const void* data, size_t size,
+                                 size_t elementSize);
+void decodeBytes(const std::vector<uint8_t>& encoded, void* data, size_t size,
+                 size_t elementSize);
+
+// width of the quantiser's bins for values of up to largest, so that a
+// bin, rounded back to float, is within tolerance of every value in it.
+// residuals the reader adds to values of up to base are rounded twice
+// more, when taken and when added, and the bins narrow to cover that too.
+// zero when no such width is usable, which means storing losslessly
+double quantiserBinWidth(double largest, float tolerance,
+                         float base = 0.0F);
+
+// error-bounded: every value is reconstructed to within tolerance; values
+// are quantised, delta coded against the value stride elements earlier and
+// packed with encodeBytes. A tolerance of zero, or data the quantiser cannot
+// represent, is stored losslessly instead. The bin width travels with the
+// data, so decoding needs no tolerance
+std::vector<uint8_t> encodeFloats(const float* data, size_t count,
+                                  size_t stride, float tolerance);
+void decodeFloats(const std::vector<uint8_t>& encoded, float* data,
+                  size_t count, size_t stride);
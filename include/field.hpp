@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// where field storage comes from; an empty directory means the heap
+struct FieldStorage {
+  // mapped files are created (and immediately unlinked) in this directory
+  std::string directory;
+  // z-planes per chunk when stages stream the grid, 0 processes it whole
+  size_t slabDepth = 0;
+  // when set, an allocation of exactly fileBytes maps that region of the
+  // file copy-on-write instead, so its pages are only read once touched
+  std::string file;
+  size_t fileOffset = 0;
+  size_t fileBytes = 0;
+};
+
+void* mapFieldMemory(const FieldStorage& storage, size_t bytes);
+void unmapFieldMemory(void* data, size_t bytes);
+void* mapFieldFile(const FieldStorage& storage);
+void unmapFieldFile(void* data, const FieldStorage& storage);
+
+enum class PageAdvice : uint8_t { Prefetch, Evict };
+
+// advise the kernel about [beginByte, endByte) of a mapped field
+void adviseFieldPages(const void* data, size_t beginByte, size_t endByte,
+                      PageAdvice advice);
+
+// allocates field memory from the heap or from a memory-mapped file
+template <typename T>
+class FieldAllocator {
+ public:
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  FieldAllocator() = default;
+  explicit FieldAllocator(std::shared_ptr<const FieldStorage> fieldStorage)
+      : storage(std::move(fieldStorage)) {}
+
+  template <typename U>
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  FieldAllocator(const FieldAllocator<U>& other)
+      : storage(other.getStorage()) {}
+
+  T* allocate(size_t count) {
+    if (adopts(count)) return static_cast<T*>(mapFieldFile(*storage));
+    if (!isMapped()) return std::allocator<T>().allocate(count);
+    return static_cast<T*>(mapFieldMemory(*storage, count * sizeof(T)));
+  }
+
+  void deallocate(T* data, size_t count) {
+    if (adopts(count)) {
+      unmapFieldFile(data, *storage);
+      return;
+    }
+    if (!isMapped()) {
+      std::allocator<T>().deallocate(data, count);
+      return;
+    }
+    unmapFieldMemory(data, count * sizeof(T));
+  }
+
+  // adopted elements already hold the file's bytes, so resizing leaves them
+  // alone; field elements are implicit-lifetime types, so the mapping
+  // itself provides the objects. Only meant for fields that never grow
+  template <typename U>
+  void construct(U* data) {
+    if (isAdopting()) return;
+    ::new (static_cast<void*>(data)) U();
+  }
+
+  template <typename U, typename... Args>
+  void construct(U* data, Args&&... args) {
+    ::new (static_cast<void*>(data)) U(std::forward<Args>(args)...);
+  }
+
+  // copies get fresh memory rather than another mapping of the file
+  [[nodiscard]] FieldAllocator select_on_container_copy_construction() const {
+    if (!isAdopting()) return *this;
+    auto plain = std::make_shared<FieldStorage>(*storage);
+    plain->file.clear();
+    return FieldAllocator(std::move(plain));
+  }
+
+  [[nodiscard]] bool isAdopting() const {
+    return storage != nullptr && !storage->file.empty();
+  }
+
+  [[nodiscard]] bool isMapped() const {
+    return storage != nullptr && !storage->directory.empty();
+  }
+
+  [[nodiscard]] size_t slabDepth() const {
+    return storage != nullptr ? storage->slabDepth : 0;
+  }
+
+  [[nodiscard]] const std::shared_ptr<const FieldStorage>& getStorage() const {
+    return storage;
+  }
+
+ private:
+  [[nodiscard]] bool adopts(size_t count) const {
+    return isAdopting() && count * sizeof(T) == storage->fileBytes;
+  }
+
+  std::shared_ptr<const FieldStorage> storage;
+};
+
+template <typename T, typename U>
+bool operator==(const FieldAllocator<T>& a, const FieldAllocator<U>& b) {
+  return a.getStorage() == b.getStorage();
+}
+
+template <typename T, typename U>
+bool operator!=(const FieldAllocator<T>& a, const FieldAllocator<U>& b) {
+  return !(a == b);
+}
+
+template <typename T>
+using Field = std::vector<T, FieldAllocator<T>>;
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "field.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+constexpr const char* FIELD_VELOCITY = "velocity";
+constexpr const char* FIELD_DENSITY = "density";
+constexpr const char* FIELD_PRESSURE = "pressure";
+constexpr const char* FIELD_DIVERGENCE = "divergence";
+constexpr const char* FIELD_PRESSURE_SCRATCH = "pressure.scratch";
+constexpr const char* FIELD_VECTOR_SCRATCH = "vector.scratch";
+constexpr const char* FIELD_SCALAR_SCRATCH = "scalar.scratch";
+constexpr const char* FIELD_VECTOR_SCRATCH_2 = "vector.scratch.2";
+constexpr const char* FIELD_SCALAR_SCRATCH_2 = "scalar.scratch.2";
+constexpr const char* FIELD_BACKTRACE = "backtrace";
+constexpr const char* FIELD_FORWARD_TRACE = "backtrace.forward";
+
+// fields are tracked for writes in tiles of 2^FIELD_TILE_SHIFT elements
+constexpr size_t FIELD_TILE_SHIFT = 12;
+
+enum class FieldLifetime : uint8_t {
+  Persistent,  // allocated when registered
+  Lazy         // allocated the first time a stage asks for it
+};
+
+struct FieldUsage {
+  std::string name;
+  size_t elementSize;
+  size_t elementCount;
+  size_t allocatedBytes;
+  FieldLifetime lifetime;
+};
+
+struct MemoryReport {
+  std::vector<FieldUsage> fields;
+  size_t allocatedBytes = 0;
+  // bytes once every lazy field has been allocated
+  size_t peakBytes = 0;
+};
+
+// owns every buffer of a simulation so memory can be accounted for in one
+// place; references handed out stay valid for the registry's lifetime
+class FieldRegistry {
+ public:
+  FieldRegistry(size_t elementCount, const FieldAllocator<float>& allocator)
+      : elements(elementCount), fieldAllocator(allocator) {}
+
+  // count overrides the registry's element count for fields on another
+  // grid, such as the face-centred velocity components
+  template <typename T>
+  Field<T>& add(const std::string& name, FieldLifetime lifetime,
+                const T& initial = T{}, size_t count = 0) {
+    const size_t fieldCount = count == 0 ? elements : count;
+    Entry entry{Field<T>(FieldAllocator<T>(fieldAllocator)), initial,
+                lifetime, fieldCount,
+                std::vector<uint64_t>(tileCount(fieldCount))};
+    auto [it, inserted] = entries.emplace(name, std::move(entry));
+    if (!inserted) {
+      throw std::runtime_error("Field already registered: " + name);
+    }
+    Field<T>& field = std::get<Field<T>>(it->second.data);
+    if (lifetime == FieldLifetime::Persistent) {
+      field.assign(it->second.count, initial);
+      markWritten(name);
+    }
+    return field;
+  }
+
+  // returns the field, allocating it first if it is lazy and not yet in use
+  template <typename T>
+  Field<T>& get(const std::string& name) {
+    Entry& entry = find(name);
+    auto* field = std::get_if<Field<T>>(&entry.data);
+    if (field == nullptr) {
+      throw std::runtime_error("Field has a different type: " + name);
+    }
+    if (field->empty()) {
+      field->assign(entry.count, std::get<T>(entry.initial));
+      markWritten(name);
+    }
+    return *field;
+  }
+
+  // every stage that writes a field reports the elements [first, last) it
+  // wrote, so snapshots can tell which tiles changed without comparing
+  // them; each call stamps its tiles with a number no other write shares
+  void markWritten(const std::string& name, size_t first = 0,
+                   size_t last = SIZE_MAX);
+  // write stamp of each tile of the field; a tile whose stamp is unchanged
+  // holds the same values as when the stamp was last read
+  [[nodiscard]] const std::vector<uint64_t>& writeStamps(
+      const std::string& name) const;
+
+  // calls fn(name, lifetime, field) for every registered field
+  template <typename Fn>
+  void forEachField(Fn&& fn) {
+    for (auto& [name, entry] : entries) {
+      std::visit([&](auto& field) { fn(name, entry.lifetime, field); },
+                 entry.data);
+    }
+  }
+
+  template <typename Fn>
+  void forEachField(Fn&& fn) const {
+    for (const auto& [name, entry] : entries) {
+      std::visit([&](const auto& field) { fn(name, entry.lifetime, field); },
+                 entry.data);
+    }
+  }
+
+  // frees a lazy field until a stage asks for it again
+  void release(const std::string& name);
+
+  [[nodiscard]] bool isAllocated(const std::string& name) const;
+  [[nodiscard]] size_t elementCount() const { return elements; }
+  [[nodiscard]] MemoryReport report() const;
+
+  // bytes per storage element once every registered field is allocated,
+  // rounded up; fields on other grids count in proportion to their size
+  [[nodiscard]] size_t bytesPerElement() const;
+
+ private:
+  struct Entry {
+    std::variant<Field<float>, Field<Vec3>, Field<SamplePoint>> data;
+    std::variant<float, Vec3, SamplePoint> initial;
+    FieldLifetime lifetime;
+    size_t count;
+    std::vector<uint64_t> stamps;  // per tile
+  };
+
+  static size_t tileCount(size_t count) {
+    return (count + (size_t{1} << FIELD_TILE_SHIFT) - 1) >> FIELD_TILE_SHIFT;
+  }
+
+  size_t elements;
+  FieldAllocator<float> fieldAllocator;
+  std::map<std::string, Entry> entries;
+
+  Entry& find(const std::string& name);
+  [[nodiscard]] const Entry& find(const std::string& name) const;
+};
+
+void printMemoryReport(std::ostream& out, const MemoryReport& report);
+
+// largest grid with the aspect ratio of nx:ny:nz whose storage, at
+// bytesPerElement, stays within memoryCap
+Grid3D fitGridToMemory(size_t memoryCap, size_t bytesPerElement, size_t nx,
+                       size_t ny, size_t nz,
+                       GridLayout layout = GridLayout::Linear);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "bounded_queue.hpp"
+#include "snapshot.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// destination for frames; every call on one sink comes from the same
+// writer thread, so sinks need no locking of their own
+class FrameSink {
+ public:
+  FrameSink() = default;
+  virtual ~FrameSink() = default;
+  FrameSink(const FrameSink&) = delete;
+  FrameSink& operator=(const FrameSink&) = delete;
+  FrameSink(FrameSink&&) = delete;
+  FrameSink& operator=(FrameSink&&) = delete;
+
+  virtual void write(const LiquidSnapshot& frame) = 0;
+  // called once after the last frame
+  virtual void finish() {}
+};
+
+enum class QueuePolicy : uint8_t {
+  Block,  // the solver waits for a free slot; every frame is written
+  Drop    // a frame that finds any queue full is skipped by every sink
+};
+
+struct FrameWriterSettings {
+  size_t queueDepth = 4;
+  size_t writerThreads = 1;
+  QueuePolicy policy = QueuePolicy::Block;
+};
+
+// moves output off the solver thread: submit() only queues a snapshot,
+// whose tiles the solver no longer writes to, and writer threads serialise
+// it. Sinks are spread over the threads, and each writes frames in order
+class FrameWriter {
+ public:
+  explicit FrameWriter(std::vector<std::unique_ptr<FrameSink>> frameSinks,
+                       FrameWriterSettings writerSettings = {});
+  ~FrameWriter();
+
+  FrameWriter(const FrameWriter&) = delete;
+  FrameWriter& operator=(const FrameWriter&) = delete;
+  FrameWriter(FrameWriter&&) = delete;
+  FrameWriter& operator=(FrameWriter&&) = delete;
+
+  // returns false if the frame was dropped
+  bool submit(std::shared_ptr<const LiquidSnapshot> frame);
+
+  // writes everything still queued, finishes every sink and rethrows the
+  // first error a sink raised
+  void close();
+
+  [[nodiscard]] size_t droppedFrames() const { return dropped.load(); }
+
+ private:
+  using Frame = std::shared_ptr<const LiquidSnapshot>;
+
+  struct Worker {
+    explicit Worker(size_t depth) : queue(depth) {}
+    BoundedQueue<Frame> queue;
+    std::vector<FrameSink*> sinks;
+    std::thread thread;
+  };
+
+  FrameWriterSettings settings;
+  std::vector<std::unique_ptr<FrameSink>> sinks;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<size_t> dropped{0};
+  bool closed = false;
+  std::mutex errorMutex;
+  std::exception_ptr error;
+
+  void run(Worker& worker);
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "field.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// signed distance to a free surface, negative inside the liquid. Values
+// are only stored in 8^3 blocks within bandWidth cells of the interface;
+// every other cell reads as -bandWidth or +bandWidth from its block's sign,
+// so storage and update cost follow the surface area rather than the volume
+class NarrowBandLevelSet {
+ public:
+  static constexpr size_t BLOCK_SHIFT = Grid3D::TILE_SHIFT;
+  static constexpr size_t BLOCK_EDGE = Grid3D::TILE_EDGE;
+  static constexpr size_t BLOCK_MASK = Grid3D::TILE_MASK;
+  static constexpr size_t BLOCK_CELLS = BLOCK_EDGE * BLOCK_EDGE * BLOCK_EDGE;
+  static constexpr float DEFAULT_BAND = 3.0F;
+
+  explicit NarrowBandLevelSet(const Grid3D& grid,
+                              float bandWidth = DEFAULT_BAND);
+
+  // fills the band from signedDistance(pos) in cell coordinates; blocks
+  // whose centre is clearly away from the surface only get a sign, so the
+  // function must not overestimate the distance
+  template <typename Fn>
+  void initialise(Fn&& signedDistance);
+
+  // distance at a cell; coordinates are clamped to the grid
+  [[nodiscard]] float value(int x, int y, int z) const;
+  // trilinear sample at a point in cell coordinates
+  [[nodiscard]] float sample(const Vec3& pos) const;
+
+  // semi-Lagrangian step of the band cells through the cell-centred
+  // velocity; call redistance() afterwards to restore the distance property
+  void advect(const Field<Vec3>& velocity, float timeStep);
+
+  // recomputes distances inside the band by fast marching out from the
+  // interface, then grows the band towards the surface and drops blocks it
+  // has left
+  void redistance();
+
+  [[nodiscard]] size_t activeBlockCount() const { return active.size(); }
+  [[nodiscard]] size_t storedBytes() const;
+  [[nodiscard]] float bandWidth() const { return band; }
+
+ private:
+  // block table entries that are not a slot in the value pool
+  static constexpr int32_t INSIDE = -1;
+  static constexpr int32_t OUTSIDE = -2;
+
+  Grid3D grid;
+  float band;
+  size_t blocksX, blocksY, blocksZ;
+  std::vector<int32_t> blockTable;
+  // block index of each slot, and BLOCK_CELLS values per slot
+  std::vector<size_t> active;
+  std::vector<float> values;
+  std::vector<float> scratch;
+
+  [[nodiscard]] size_t blockOf(size_t x, size_t y, size_t z) const {
+    return (x >> BLOCK_SHIFT) +
+           blocksX * ((y >> BLOCK_SHIFT) + blocksY * (z >> BLOCK_SHIFT));
+  }
+  static size_t localOf(size_t x, size_t y, size_t z) {
+    return (x & BLOCK_MASK) +
+           BLOCK_EDGE * ((y & BLOCK_MASK) + BLOCK_EDGE * (z & BLOCK_MASK));
+  }
+  // first cell of a block
+  void blockOrigin(size_t block, size_t& x, size_t& y, size_t& z) const;
+  // cell held at a pool index
+  void cellOf(size_t index, size_t& x, size_t& y, size_t& z) const;
+  [[nodiscard]] bool inGrid(size_t x, size_t y, size_t z) const {
+    return x < grid.nx && y < grid.ny && z < grid.nz;
+  }
+
+  // pool index of a cell, or -1 when its block is not stored
+  [[nodiscard]] int64_t slotIndex(size_t x, size_t y, size_t z) const;
+
+  void activate(size_t block, float fill);
+  void dilate();
+  void compact();
+};
+
+template <typename Fn>
+void NarrowBandLevelSet::initialise(Fn&& signedDistance) {
+  constexpr float HALF = 0.5F;
+  // farthest any cell of a block is from its centre
+  const float blockRadius =
+      HALF * std::sqrt(3.0F) * static_cast<float>(BLOCK_EDGE);
+
+  active.clear();
+  values.clear();
+  for (size_t block = 0; block < blockTable.size(); ++block) {
+    size_t x0 = 0, y0 = 0, z0 = 0;
+    blockOrigin(block, x0, y0, z0);
+    const float centreOffset = HALF * static_cast<float>(BLOCK_EDGE - 1);
+    const Vec3 centre{static_cast<float>(x0) + centreOffset,
+                      static_cast<float>(y0) + centreOffset,
+                      static_cast<float>(z0) + centreOffset};
+
+    const float distance = signedDistance(centre);
+    if (std::fabs(distance) > band + blockRadius) {
+      blockTable[block] = distance < 0.0F ? INSIDE : OUTSIDE;
+      continue;
+    }
+
+    activate(block, 0.0F);
+    float* cells = &values[(active.size() - 1) * BLOCK_CELLS];
+    for (size_t local = 0; local < BLOCK_CELLS; ++local) {
+      const size_t lx = local & BLOCK_MASK;
+      const size_t ly = (local >> BLOCK_SHIFT) & BLOCK_MASK;
+      const size_t lz = local >> (2 * BLOCK_SHIFT);
+      const Vec3 pos = {static_cast<float>(x0 + lx),
+                        static_cast<float>(y0 + ly),
+                        static_cast<float>(z0 + lz)};
+      cells[local] = std::clamp(signedDistance(pos), -band, band);
+    }
+  }
+  compact();
+}
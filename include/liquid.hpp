@@ -1,24 +1,99 @@
 #pragma once
 
+#include "advection.hpp"
+#include "field.hpp"
+#include "field_registry.hpp"
+#include "level_set.hpp"
 #include "vec3.hpp"
+#include "vector_math.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 constexpr float DENSITY_WATER_KG_PER_M3 = 997.0F;
 constexpr float GRAVITY_FORCE_EARTH_M_PER_S2 = 9.807F;
+// the body force every solver adds each step, on top of config.force
+constexpr Vec3 GRAVITY{0, 0, -GRAVITY_FORCE_EARTH_M_PER_S2};
 constexpr float VISCOSITY_WATER_M2_PER_S = 1.0e-6F;
 constexpr float WATER_DIFFUSION_RATE = 0.001F;
+constexpr size_t DEFAULT_SOLVER_ITERATIONS = 20;
+
+enum class VelocityLayout : uint8_t {
+  Collocated,  // every component at the cell centre
+  Staggered    // components on cell faces (MAC); see mac_grid.hpp
+};
 
 struct Liquid {
-  std::vector<Vec3> velocity;
-  std::vector<float> density;
-  std::vector<float> pressure;
+  // owns every buffer below plus the solver's scratch fields
+  FieldRegistry fields;
+  Field<Vec3>& velocity;
+  Field<float>& density;
+  Field<float>& pressure;
   float viscosity;
   float diffusionRate;
+  // with Staggered the solver works on face fields and keeps velocity as
+  // their cell-centred average for the density pass and the renderer
+  VelocityLayout velocityLayout = VelocityLayout::Collocated;
+  // fastest cell speed (cells per unit time) after the last projection
+  float maxSpeed = 0.0F;
+  BacktraceOrder backtraceOrder = BacktraceOrder::Euler;
+  AdvectionScheme velocityAdvection = AdvectionScheme::SemiLagrangian;
+  // also used for the passive scalars, which share density's backtrace
+  AdvectionScheme densityAdvection = AdvectionScheme::SemiLagrangian;
+  // cells per coarse cell along each axis for density; above 1 density is
+  // solved on a refined grid (see refinement.hpp) and this density field
+  // holds its average
+  size_t densityRefinement = 1;
+  // sampler used when advecting along the cached traces
+  Interpolation interpolation = Interpolation::Trilinear;
+  // Jacobi sweeps per pressure solve and per diffusion, and the change
+  // below which a solve stops before running them all (0 never stops early)
+  size_t pressureIterations = DEFAULT_SOLVER_ITERATIONS;
+  size_t diffusionIterations = DEFAULT_SOLVER_ITERATIONS;
+  float pressureTolerance = 0.0F;
+  float diffusionTolerance = 0.0F;
+  // extra scalars carried by the flow (temperature, dyes); advected with
+  // density but not diffused
+  std::vector<std::string> passiveScalars;
+  // free surface tracked through the flow, advected and redistanced every
+  // step; null when the liquid fills the grid
+  std::unique_ptr<NarrowBandLevelSet> surface;
 
-  Liquid(size_t nx, size_t ny, size_t nz, float visc, float diffRate)
-      : velocity(nx * ny * nz),
-        density(nx * ny * nz, DENSITY_WATER_KG_PER_M3),
-        pressure(nx * ny * nz, 0.0F),
+  // fields are sized for the grid's storage, which includes layout padding;
+  // the allocator decides whether they live on the heap or in mapped files
+  Liquid(const Grid3D& grid, float visc, float diffRate,
+         const FieldAllocator<float>& allocator = {})
+      : fields(grid.size(), allocator),
+        velocity(fields.add<Vec3>(FIELD_VELOCITY, FieldLifetime::Persistent)),
+        density(fields.add<float>(FIELD_DENSITY, FieldLifetime::Persistent,
+                                  DENSITY_WATER_KG_PER_M3)),
+        pressure(fields.add<float>(FIELD_PRESSURE, FieldLifetime::Persistent)),
         viscosity(visc),
-        diffusionRate(diffRate) {}
+        diffusionRate(diffRate) {
+    fields.add<float>(FIELD_DIVERGENCE, FieldLifetime::Lazy);
+    fields.add<float>(FIELD_PRESSURE_SCRATCH, FieldLifetime::Lazy);
+    fields.add<Vec3>(FIELD_VECTOR_SCRATCH, FieldLifetime::Lazy);
+    fields.add<float>(FIELD_SCALAR_SCRATCH, FieldLifetime::Lazy);
+    fields.add<Vec3>(FIELD_VECTOR_SCRATCH_2, FieldLifetime::Lazy);
+    fields.add<float>(FIELD_SCALAR_SCRATCH_2, FieldLifetime::Lazy);
+    fields.add<SamplePoint>(FIELD_BACKTRACE, FieldLifetime::Lazy);
+    fields.add<SamplePoint>(FIELD_FORWARD_TRACE, FieldLifetime::Lazy);
+  }
+
+  Field<float>& addPassiveScalar(const std::string& name,
+                                 float initial = 0.0F) {
+    Field<float>& field =
+        fields.add<float>(name, FieldLifetime::Persistent, initial);
+    passiveScalars.push_back(name);
+    return field;
+  }
+
+  // the field references point into this instance's registry
+  Liquid(const Liquid&) = delete;
+  Liquid& operator=(const Liquid&) = delete;
+  Liquid(Liquid&&) = delete;
+  Liquid& operator=(Liquid&&) = delete;
+  ~Liquid() = default;
 };
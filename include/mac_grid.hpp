@@ -0,0 +1,70 @@
+#pragma once
+
+#include "field.hpp"
+#include "liquid.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+
+constexpr const char* FIELD_FACE_U = "velocity.u";
+constexpr const char* FIELD_FACE_V = "velocity.v";
+constexpr const char* FIELD_FACE_W = "velocity.w";
+constexpr const char* FIELD_FACE_U_SCRATCH = "velocity.u.scratch";
+constexpr const char* FIELD_FACE_V_SCRATCH = "velocity.v.scratch";
+constexpr const char* FIELD_FACE_W_SCRATCH = "velocity.w.scratch";
+
+// grids of a staggered (MAC) layout. u lives on the x faces: face i sits
+// between cells i - 1 and i, at x = i - 0.5 in cell coordinates, so there
+// are nx + 1 of them; v and w likewise along y and z
+struct MacGrid {
+  Grid3D cells;
+  Grid3D uFaces, vFaces, wFaces;
+
+  explicit MacGrid(const Grid3D& grid)
+      : cells(grid),
+        uFaces(grid.nx + 1, grid.ny, grid.nz, grid.layout),
+        vFaces(grid.nx, grid.ny + 1, grid.nz, grid.layout),
+        wFaces(grid.nx, grid.ny, grid.nz + 1, grid.layout) {}
+};
+
+struct FaceVelocity {
+  Field<float>& u;
+  Field<float>& v;
+  Field<float>& w;
+};
+
+// registers the face fields, seeds them from the cell-centred velocity and
+// switches the fluid to the staggered solver
+void enableStaggeredVelocity(const Grid3D& grid, Liquid& fluid);
+
+FaceVelocity faceVelocity(Liquid& fluid);
+// tells the registry all three face components were written
+void markFacesWritten(Liquid& fluid);
+
+// adds the same velocity change to every face
+void addFaceImpulse(const Vec3& impulse, FaceVelocity& faces);
+
+// net outflow of each cell; with unit spacing this pairs with the backward
+// difference gradient below into the compact 7-point Laplacian
+void computeMacDivergence(MacGrid& mac, const FaceVelocity& faces,
+                          Field<float>& divergence);
+
+// walls are solid, so boundary faces are zeroed rather than corrected
+void subtractMacPressureGradient(MacGrid& mac, const Field<float>& pressure,
+                                 FaceVelocity& faces);
+
+// velocity at a point in cell coordinates, each component interpolated on
+// its own face grid
+Vec3 sampleMacVelocity(const MacGrid& mac, const FaceVelocity& faces,
+                       const Vec3& pos);
+
+// semi-Lagrangian advection of every face component into dst
+void advectMac(MacGrid& mac, const FaceVelocity& faces, float timeStep,
+               FaceVelocity& dst);
+
+// averages the faces back to cell centres; returns the fastest speed
+float facesToCells(MacGrid& mac, const FaceVelocity& faces,
+                   Field<Vec3>& velocity);
+
+// forces, diffusion, projection and advection of the face velocity, ending
+// with fluid.velocity and fluid.maxSpeed refreshed from the faces
+void stepStaggeredVelocity(Grid3D& grid, Liquid& fluid, float timeStep);
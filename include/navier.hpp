@@ -1,97 +1,119 @@
 #pragma once
 
+#include "advection.hpp"
+#include "field.hpp"
 #include "liquid.hpp"
+#include "slab_streamer.hpp"
 #include "vector_math.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
 #include <vector>
 
-int navier();
+struct SimConfig;
 
+// headless run of config.frames frames; storage can be memory-mapped to
+// run grids larger than RAM
+int navier(const SimConfig& config,
+           std::shared_ptr<const FieldStorage> storage = nullptr);
+
+// adds force * timeStep to the velocity, and to the faces when staggered
 void applyForces(float timeStep, const Vec3& force, Liquid& fluid);
 
-void printDensitySlice(Grid3D& grid, const std::vector<float>& density,
+void printDensitySlice(Grid3D& grid, const Field<float>& density,
                        size_t zSlice);
 
-template <typename VelT, typename FieldT>
-void advect(Grid3D& grid, const std::vector<VelT>& velocityField,
-            std::vector<FieldT>& field, float timeStep) {
-  constexpr float CELL_CENTER_OFFSET = 0.5F;
-
-  for (size_t z = 0; z < grid.nz; ++z) {
-    for (size_t y = 0; y < grid.ny; ++y) {
-      for (size_t x = 0; x < grid.nx; ++x) {
-        // cast loop indices to int for grid indexing
-        int ix = static_cast<int>(x);
-        int iy = static_cast<int>(y);
-        int iz = static_cast<int>(z);
-
-        size_t index = grid.idx(ix, iy, iz);
-        Vec3 currentCell = {static_cast<float>(x) + CELL_CENTER_OFFSET,
-                            static_cast<float>(y) + CELL_CENTER_OFFSET,
-                            static_cast<float>(z) + CELL_CENTER_OFFSET};
-
-        Vec3 prevPos = currentCell - velocityField[index] * timeStep;
-
-        field[index] = trilinearInterpolate(grid, field, prevPos);
-      }
-    }
-  }
-}
-
+// one explicit diffusion sweep over z-planes [zBegin, zEnd); returns the
+// largest change of any component
 template <typename T>
-void diffuse(Grid3D& grid, std::vector<T>& data, std::vector<T>& temp,
-             float coefficient, float timeStep) {
+float diffuseSlab(Grid3D& grid, const Field<T>& src, Field<T>& dst,
+                 float coefficient, float timeStep, size_t zBegin,
+                 size_t zEnd) {
   constexpr float NUM_OF_NEIGHBOURS = 6.0F;
-  constexpr size_t MAX_ITERATIONS = 20;
-
-  std::vector<T>* src = &data;
-  std::vector<T>* dst = &temp;
 
-  for (size_t i = 0; i < MAX_ITERATIONS; ++i) {
-    for (size_t z = 0; z < grid.nz; ++z) {
-      for (size_t y = 0; y < grid.ny; ++y) {
-        for (size_t x = 0; x < grid.nx; ++x) {
+  return withLayout(grid, [&](const auto& cells) {
+    float largestChange = 0.0F;
+    for (size_t z = zBegin; z < zEnd; ++z) {
+      for (size_t y = 0; y < cells.ny; ++y) {
+        for (size_t x = 0; x < cells.nx; ++x) {
           // cast loop indices to int for neighbor calculations
           int ix = static_cast<int>(x);
           int iy = static_cast<int>(y);
           int iz = static_cast<int>(z);
 
-          size_t index = grid.idx(ix, iy, iz);
+          size_t index = cells.idx(ix, iy, iz);
           T neighbourSum{};
 
           // x neighbours
-          neighbourSum += (*src)[grid.idx(ix - 1, iy, iz)];
-          neighbourSum += (*src)[grid.idx(ix + 1, iy, iz)];
+          neighbourSum += src[cells.idx(ix - 1, iy, iz)];
+          neighbourSum += src[cells.idx(ix + 1, iy, iz)];
 
           // y neighbours
-          neighbourSum += (*src)[grid.idx(ix, iy - 1, iz)];
-          neighbourSum += (*src)[grid.idx(ix, iy + 1, iz)];
+          neighbourSum += src[cells.idx(ix, iy - 1, iz)];
+          neighbourSum += src[cells.idx(ix, iy + 1, iz)];
 
           // z neighbours
-          neighbourSum += (*src)[grid.idx(ix, iy, iz - 1)];
-          neighbourSum += (*src)[grid.idx(ix, iy, iz + 1)];
+          neighbourSum += src[cells.idx(ix, iy, iz - 1)];
+          neighbourSum += src[cells.idx(ix, iy, iz + 1)];
 
           // laplacian
-          T laplacian = neighbourSum - NUM_OF_NEIGHBOURS * (*src)[index];
+          T laplacian = neighbourSum - NUM_OF_NEIGHBOURS * src[index];
 
           // diffuse
-          (*dst)[index] = (*src)[index] + coefficient * timeStep * laplacian;
+          const T change = coefficient * timeStep * laplacian;
+          dst[index] = src[index] + change;
+          largestChange = std::max(largestChange, componentMaxAbs(change));
         }
       }
     }
+    return largestChange;
+  });
+}
+
+// up to iterations sweeps; with a tolerance it stops early once no
+// component changes by more than that in a sweep
+template <typename T>
+void diffuse(Grid3D& grid, Field<T>& data, Field<T>& temp,
+             float coefficient, float timeStep,
+             size_t iterations = DEFAULT_SOLVER_ITERATIONS,
+             float tolerance = 0.0F) {
+  Field<T>* src = &data;
+  Field<T>* dst = &temp;
+
+  SlabStreamer streamer(grid, data.get_allocator().slabDepth());
+  streamer.track(data).track(temp);
+
+  for (size_t i = 0; i < iterations; ++i) {
+    float largestChange = 0.0F;
+    streamer.run([&](size_t zBegin, size_t zEnd) {
+      largestChange = std::max(
+          largestChange, diffuseSlab(grid, *src, *dst, coefficient,
+                                     timeStep, zBegin, zEnd));
+    });
     std::swap(dst, src);
+    if (largestChange < tolerance) break;
   }
   if (src != &data) {
     data = *src;
   }
 }
 
-void computeDivergence(Grid3D& grid, const std::vector<Vec3>& velocity,
-                       std::vector<float>& divergence);
-void solvePressure(Grid3D& grid, std::vector<float>& divergence,
-                   std::vector<float>& pressure);
-void subtractPressureGradient(Grid3D& grid, std::vector<float>& pressure,
-                              std::vector<Vec3>& velocity);
-void project(Grid3D& grid, Liquid& fluid, std::vector<float>& divergence,
-             std::vector<float>& pressure);
-void simulateStep(Grid3D& grid, Liquid& fluid, std::vector<float>& divergence,
-                  std::vector<float>& pressure, float timeStep);
+void computeDivergence(Grid3D& grid, const Field<Vec3>& velocity,
+                       Field<float>& divergence);
+// Jacobi iterations; with a tolerance it stops early once no cell changes
+// by more than that in an iteration
+void solvePressure(Grid3D& grid, Field<float>& divergence,
+                   Field<float>& pressure, Field<float>& pressureScratch,
+                   size_t iterations = DEFAULT_SOLVER_ITERATIONS,
+                   float tolerance = 0.0F);
+// returns the fastest speed left in the field, which the pass already reads
+float subtractPressureGradient(Grid3D& grid, Field<float>& pressure,
+                               Field<Vec3>& velocity);
+// returns the fastest speed after projection
+float project(Grid3D& grid, Liquid& fluid);
+void simulateStep(Grid3D& grid, Liquid& fluid, float timeStep);
+// the density, passive scalar and free surface half of simulateStep,
+// through whatever velocity the fluid holds; for solvers that move the
+// velocity themselves
+void stepScalars(Grid3D& grid, Liquid& fluid, float timeStep);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "parallel.hpp"
+#include "snapshot.hpp"
+#include "vector_math.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class Axis : uint8_t { X, Y, Z };
+
+// cells a writer emits: the box [begin, end) on each axis, keeping every
+// stride-th cell from begin. The default covers the whole grid; ends past
+// the grid are clipped to it
+struct OutputRegion {
+  std::array<size_t, 3> begin{0, 0, 0};
+  std::array<size_t, 3> end{SIZE_MAX, SIZE_MAX, SIZE_MAX};
+  size_t stride = 1;
+
+  static OutputRegion box(const std::array<size_t, 3>& from,
+                          const std::array<size_t, 3>& to, size_t stride = 1);
+  static OutputRegion plane(Axis axis, size_t index, size_t stride = 1);
+  static OutputRegion decimated(size_t stride);
+
+  // copy limited to the grid; throws if nothing is left
+  [[nodiscard]] OutputRegion clippedTo(const Grid3D& grid) const;
+  // cells kept along each axis, for a clipped region
+  [[nodiscard]] std::array<size_t, 3> extent() const;
+  [[nodiscard]] size_t cellCount() const;
+  [[nodiscard]] bool covers(const Grid3D& grid) const;
+};
+
+// "all", "box:x0,y0,z0,x1,y1,z1" or "plane:z=32", optionally followed by
+// "/stride", e.g. "plane:y=64/2"
+OutputRegion parseOutputRegion(const std::string& text);
+
+// copies the cells of a clipped region out of a field in x-fastest order,
+// one output z-plane per task
+template <typename T>
+void extractRegion(const Grid3D& grid, const FieldSnapshot<T>& field,
+                   const OutputRegion& region, std::vector<T>& out) {
+  const std::array<size_t, 3> extent = region.extent();
+  const size_t stride = region.stride;
+  out.resize(region.cellCount());
+
+  parallelFor(extent[2], [&](size_t zBegin, size_t zEnd) {
+    for (size_t k = zBegin; k < zEnd; ++k) {
+      const size_t z = region.begin[2] + k * stride;
+      T* dst = out.data() + extent[0] * extent[1] * k;
+      for (size_t j = 0; j < extent[1]; ++j) {
+        const size_t y = region.begin[1] + j * stride;
+        for (size_t i = 0; i < extent[0]; ++i) {
+          *dst++ = field[grid.offset(region.begin[0] + i * stride, y, z)];
+        }
+      }
+    }
+  });
+}
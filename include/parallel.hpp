@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// threads parallelFor splits work across, counting the calling thread;
+// 0 uses every hardware thread
+void setThreadCount(size_t count);
+size_t threadCount();
+
+// runs body(begin, end) over disjoint chunks covering [0, count) and returns
+// once all of them are done; nested or concurrent calls run serially on the
+// calling thread
+void parallelFor(size_t count,
+                 const std::function<void(size_t, size_t)>& body);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "time_series.hpp"
+#include "vector_math.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr size_t DEFAULT_READ_AHEAD = 4;
+
+// plays a recording back in order while a background thread decodes the
+// frames after the current one and pages in the ones after those, so the
+// viewer only waits if decoding falls behind. Frame buffers are swapped
+// with the caller's rather than copied or reallocated
+class SeriesPlayback {
+ public:
+  explicit SeriesPlayback(const std::string& path,
+                          size_t readAhead = DEFAULT_READ_AHEAD);
+  ~SeriesPlayback();
+
+  SeriesPlayback(const SeriesPlayback&) = delete;
+  SeriesPlayback& operator=(const SeriesPlayback&) = delete;
+  SeriesPlayback(SeriesPlayback&&) = delete;
+  SeriesPlayback& operator=(SeriesPlayback&&) = delete;
+
+  [[nodiscard]] Grid3D grid() const { return reader.grid(); }
+  [[nodiscard]] size_t frameCount() const { return reader.frameCount(); }
+  // index of the frame the next call to next() returns
+  [[nodiscard]] size_t position() const;
+
+  // drops frames decoded ahead and continues from frame
+  void seek(size_t frame);
+  // moves the next frame into out, waiting for it if need be; false once
+  // the recording is exhausted. Rethrows decoding errors
+  bool next(SeriesFrame& out);
+
+ private:
+  TimeSeriesReader reader;
+  size_t depth;
+
+  mutable std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::unique_ptr<SeriesFrame>> ready;
+  std::vector<std::unique_ptr<SeriesFrame>> spare;
+  size_t cursor = 0;    // next frame to decode
+  size_t returned = 0;  // next frame next() hands out
+  size_t generation = 0;
+  bool decoding = false;
+  bool stopping = false;
+  std::exception_ptr error;
+  std::thread decoder;
+
+  void decode();
+};
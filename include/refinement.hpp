@@ -0,0 +1,59 @@
+#pragma once
+
+#include "advection.hpp"
+#include "field.hpp"
+#include "liquid.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <cstddef>
+
+constexpr const char* FIELD_DENSITY_FINE = "density.fine";
+constexpr const char* FIELD_FINE_SCRATCH = "fine.scratch";
+constexpr const char* FIELD_FINE_SCRATCH_2 = "fine.scratch.2";
+
+// grid with factor cells per coarse cell along each axis; fine cell i
+// covers coarse coordinates [(i - 0.5) / factor, (i + 0.5) / factor) - 0.5
+// so both grids span the same box
+Grid3D refineGrid(const Grid3D& grid, size_t factor);
+
+inline Vec3 fineToCoarse(const Vec3& fine, size_t factor) {
+  constexpr float HALF = 0.5F;
+  const float scale = 1.0F / static_cast<float>(factor);
+  return {(fine.x + HALF) * scale - HALF, (fine.y + HALF) * scale - HALF,
+          (fine.z + HALF) * scale - HALF};
+}
+
+inline Vec3 coarseToFine(const Vec3& coarse, size_t factor) {
+  constexpr float HALF = 0.5F;
+  const auto scale = static_cast<float>(factor);
+  return {(coarse.x + HALF) * scale - HALF, (coarse.y + HALF) * scale - HALF,
+          (coarse.z + HALF) * scale - HALF};
+}
+
+// moves density onto a grid refined by factor (2 or 4), seeded from the
+// current coarse values; velocity and pressure stay on the coarse grid
+void enableRefinedDensity(const Grid3D& grid, Liquid& fluid, size_t factor);
+
+// semi-Lagrangian step of a fine scalar through the coarse velocity,
+// interpolated at each fine cell
+void advectRefined(const Grid3D& grid, const Field<Vec3>& velocity,
+                   Grid3D& fineGrid, size_t factor, const Field<float>& src,
+                   Field<float>& dst, float timeStep, BacktraceOrder order,
+                   Interpolation interpolation);
+
+// limited MacCormack step of a fine scalar, like applyMacCormack; the
+// traces are recomputed per pass instead of cached, since a cached trace
+// would cost a SamplePoint per fine cell
+void macCormackRefined(const Grid3D& grid, const Field<Vec3>& velocity,
+                       Grid3D& fineGrid, size_t factor, Field<float>& field,
+                       Field<float>& forward, Field<float>& corrected,
+                       float timeStep, BacktraceOrder order,
+                       Interpolation interpolation);
+
+// each coarse cell becomes the mean of the fine cells it covers
+void restrictToCoarse(Grid3D& grid, const Grid3D& fineGrid, size_t factor,
+                      const Field<float>& fine, Field<float>& coarse);
+
+// diffuses and advects the fine density with fluid.densityAdvection, then
+// refreshes fluid.density
+void stepRefinedDensity(Grid3D& grid, Liquid& fluid, float timeStep);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "bounded_queue.hpp"
+#include "liquid.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HistoryConfig {
+  static constexpr size_t DEFAULT_MAX_SNAPSHOTS = 256;
+
+  size_t maxSnapshots = DEFAULT_MAX_SNAPSHOTS;
+  // budget for compressed snapshots, 0 for no limit beyond maxSnapshots
+  size_t maxBytes = 0;
+  // absolute error bound per value, 0 keeps history lossless
+  float tolerance = 0.0F;
+};
+
+// ring of compressed snapshots of a Liquid's persistent fields, so a run can
+// be rewound a few hundred steps without restarting; compression happens on a
+// background thread so recording only costs a copy on the solver thread
+class RollbackHistory {
+ public:
+  explicit RollbackHistory(const HistoryConfig& historyConfig = {});
+  ~RollbackHistory();
+
+  RollbackHistory(const RollbackHistory&) = delete;
+  RollbackHistory& operator=(const RollbackHistory&) = delete;
+  RollbackHistory(RollbackHistory&&) = delete;
+  RollbackHistory& operator=(RollbackHistory&&) = delete;
+
+  // blocks only when the compressor has fallen PENDING_SNAPSHOTS behind
+  void record(size_t step, const Liquid& fluid);
+
+  // restores the state recorded at step and forgets every later snapshot,
+  // since those belong to the run being abandoned; false if step is not held
+  bool restore(size_t step, Liquid& fluid);
+
+  [[nodiscard]] std::vector<size_t> steps();
+  [[nodiscard]] size_t compressedBytes();
+
+ private:
+  static constexpr size_t PENDING_SNAPSHOTS = 2;
+
+  struct FieldData {
+    std::string name;
+    size_t floatsPerElement;
+    size_t floatCount;
+    std::vector<float> raw;
+    std::vector<uint8_t> compressed;
+  };
+
+  struct Snapshot {
+    size_t step = 0;
+    size_t bytes = 0;
+    std::vector<FieldData> fields;
+  };
+
+  HistoryConfig config;
+  BoundedQueue<Snapshot> pending;
+  std::deque<Snapshot> snapshots;  // compressed, oldest first
+  size_t totalBytes = 0;
+  size_t inFlight = 0;
+  std::mutex mutex;
+  std::condition_variable idle;
+  std::thread worker;
+
+  void compressLoop();
+  // callers hold the lock
+  void evict();
+  void waitForCompression(std::unique_lock<std::mutex>& lock);
+};
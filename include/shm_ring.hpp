@@ -0,0 +1,128 @@
+#pragma once
+
+#include "liquid.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+constexpr size_t DEFAULT_RING_SLOTS = 3;
+
+// "/fluidsim-frames-<pid>", so runs side by side never share a ring
+std::string sharedFrameRingName();
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the frame ring needs address-free atomics");
+
+// a POSIX shared-memory object holding this header and slotCount slots.
+// Each slot starts with a ShmSlot, then velocity, density and pressure in
+// the grid's storage order, each 64-byte aligned. A slot's sequence is odd
+// while the solver writes it and 2 * (frame + 1) once frame is complete,
+// so readers never lock: they read and then check the sequence is unchanged
+struct ShmRingHeader {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t slotCount;
+  uint64_t nx, ny, nz;
+  uint64_t slotBytes;
+  uint8_t layout;
+  std::array<uint8_t, 7> reserved;
+  std::atomic<uint64_t> published;  // frames completed so far
+};
+
+struct ShmSlot {
+  std::atomic<uint64_t> sequence;
+  uint64_t step;
+  std::array<uint8_t, 48> reserved;
+};
+
+static_assert(sizeof(ShmRingHeader) == 64);
+static_assert(sizeof(ShmSlot) == 64);
+
+// where each field starts within a slot
+struct ShmSlotLayout {
+  size_t velocity, density, pressure, bytes;
+};
+ShmSlotLayout shmSlotLayout(const Grid3D& grid);
+
+// creates the ring, failing if the name is already taken, and removes the
+// name again when destroyed
+class ShmRingWriter {
+ public:
+  ShmRingWriter(std::string name, const Grid3D& grid,
+                size_t slots = DEFAULT_RING_SLOTS);
+  ~ShmRingWriter();
+
+  ShmRingWriter(const ShmRingWriter&) = delete;
+  ShmRingWriter& operator=(const ShmRingWriter&) = delete;
+  ShmRingWriter(ShmRingWriter&&) = delete;
+  ShmRingWriter& operator=(ShmRingWriter&&) = delete;
+
+  // copies the fields into the next slot, one memcpy per field split over
+  // the worker threads; called on the solver thread between steps
+  void publish(uint64_t step, const Liquid& fluid);
+
+ private:
+  std::string ringName;
+  void* mapping = nullptr;
+  size_t length = 0;
+  ShmSlotLayout layout{};
+  ShmRingHeader* header = nullptr;
+};
+
+// fields of one frame, pointing into the shared mapping
+struct ShmFrameView {
+  uint64_t frame;
+  uint64_t step;
+  const Vec3* velocity;
+  const float* density;
+  const float* pressure;
+};
+
+// maps a ring read-only
+class ShmRingReader {
+ public:
+  explicit ShmRingReader(const std::string& name);
+  ~ShmRingReader();
+
+  ShmRingReader(const ShmRingReader&) = delete;
+  ShmRingReader& operator=(const ShmRingReader&) = delete;
+  ShmRingReader(ShmRingReader&&) = delete;
+  ShmRingReader& operator=(ShmRingReader&&) = delete;
+
+  [[nodiscard]] Grid3D grid() const;
+  [[nodiscard]] uint64_t published() const {
+    return header->published.load(std::memory_order_acquire);
+  }
+
+  // calls fn with the newest complete frame, in place. Returns false if
+  // there is none yet, or if the solver came round to the slot while fn
+  // ran, in which case whatever fn read must be discarded
+  template <typename Fn>
+  bool readLatest(Fn&& fn) const {
+    const uint64_t count = published();
+    if (count == 0) return false;
+
+    const uint64_t frame = count - 1;
+    const ShmSlot& slot = slotAt(frame);
+    const uint64_t complete = 2 * (frame + 1);
+    if (slot.sequence.load(std::memory_order_acquire) != complete) {
+      return false;
+    }
+    fn(viewOf(frame));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == complete;
+  }
+
+ private:
+  const uint8_t* mapping = nullptr;
+  size_t length = 0;
+  ShmSlotLayout layout{};
+  const ShmRingHeader* header = nullptr;
+
+  [[nodiscard]] const ShmSlot& slotAt(uint64_t frame) const;
+  [[nodiscard]] ShmFrameView viewOf(uint64_t frame) const;
+};
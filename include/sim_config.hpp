@@ -0,0 +1,121 @@
+#pragma once
+
+#include "advection.hpp"
+#include "flip.hpp"
+#include "frame_writer.hpp"
+#include "level_set.hpp"
+#include "liquid.hpp"
+#include "output_region.hpp"
+#include "time_series.hpp"
+#include "timestep.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+
+enum class VelocitySolver : uint8_t {
+  Grid,  // semi-Lagrangian or MacCormack advection on the grid
+  Flip   // particles carry velocity, see flip.hpp
+};
+
+// everything a run can change without a rebuild. A config file holds one
+// "key = value" per line, with # starting a comment; the keys are listed in
+// src/sim_config.cpp. Defaults are the values that used to be compiled in
+struct SimConfig {
+  // grid
+  size_t nx = 100, ny = 100, nz = 50;
+  GridLayout layout = GridLayout::Linear;
+  // bytes the solver's fields may use; a larger grid is shrunk, keeping
+  // its proportions, until it fits. 0 for no limit
+  size_t memoryLimit = 0;
+
+  // time; frames only bounds headless runs, the window runs until closed
+  float frameTime = 0.02F;
+  size_t frames = 100;
+  TimestepSettings timestep;
+
+  // fluid
+  float viscosity = VISCOSITY_WATER_M2_PER_S;
+  float diffusionRate = WATER_DIFFUSION_RATE;
+  float initialDensity = DENSITY_WATER_KG_PER_M3;
+  // height in cells of a flat free surface tracked by a level set, with
+  // its band half-width; unset tracks no surface
+  std::optional<float> surfaceHeight;
+  float surfaceBand = NarrowBandLevelSet::DEFAULT_BAND;
+
+  // solver
+  VelocitySolver solver = VelocitySolver::Grid;
+  float flipRatio = FlipSettings::DEFAULT_FLIP_RATIO;
+  size_t particlesPerCell = FlipSettings::DEFAULT_PARTICLES_PER_CELL;
+  VelocityLayout velocityLayout = VelocityLayout::Collocated;
+  BacktraceOrder backtraceOrder = BacktraceOrder::Euler;
+  AdvectionScheme velocityAdvection = AdvectionScheme::SemiLagrangian;
+  AdvectionScheme densityAdvection = AdvectionScheme::SemiLagrangian;
+  Interpolation interpolation = Interpolation::Trilinear;
+  size_t densityRefinement = 1;
+  size_t pressureIterations = DEFAULT_SOLVER_ITERATIONS;
+  size_t diffusionIterations = DEFAULT_SOLVER_ITERATIONS;
+  float pressureTolerance = 0.0F;  // 0 always runs every iteration
+  float diffusionTolerance = 0.0F;
+  size_t threads = 0;  // 0 uses every hardware thread
+
+  // forcing: random velocity of up to stir per component added to every
+  // cell each frame, and a constant body force applied every step. Unset,
+  // the window stirs by DEFAULT_STIR and headless runs stay still, as they
+  // did before settings could be changed
+  static constexpr float DEFAULT_STIR = 1.0F;
+  std::optional<float> stir;
+  Vec3 force{};
+  uint32_t seed = 0;  // 0 seeds from the system
+
+  // rollback: compressed copies of the last historySteps steps, within
+  // historyMemory bytes (0 for no limit), to within historyTolerance
+  size_t historySteps = 0;
+  size_t historyMemory = 0;
+  float historyTolerance = 0.0F;
+
+  // checkpoints: every persistent field saved to checkpoint each
+  // checkpointEvery frames (0 only when the run finishes), and a checkpoint
+  // to start from instead of the initial state
+  std::string checkpoint;
+  size_t checkpointEvery = 0;
+  std::string restart;
+
+  // output
+  bool headless = false;
+  bool printSlices = true;   // headless: density slice after each frame
+  bool sharedFrames = false;  // window: publish frames to shared memory
+  std::string sharedFramesName;  // empty: sharedFrameRingName()
+  std::string record;        // time series path
+  std::string vti;           // prefix of per-frame .vti files
+  std::string play;          // time series to show instead of simulating
+  size_t tracers = 0;        // passive particles recorded to trajectory
+  std::string trajectory;    // tracer positions after every frame
+  OutputRegion outputRegion;
+  size_t keyframeInterval = DEFAULT_KEYFRAME_INTERVAL;
+  // largest error of a recorded value; 0 records losslessly
+  float outputTolerance = 0.0F;
+};
+
+// sets one key from its text value; throws on unknown keys or bad values
+void setConfigValue(SimConfig& config, const std::string& key,
+                    const std::string& value);
+// applies every line of a config file on top of config
+void loadConfig(const std::string& path, SimConfig& config);
+// fluidsim [config file] [key=value ...] [--headless] [--record file]
+// [--play file]; later arguments override earlier ones
+SimConfig parseCommandLine(int argc, const char* const* argv);
+
+// the configured grid, shrunk to fit memoryLimit if one is set
+Grid3D makeGrid(const SimConfig& config);
+// solver choices, fields they need, initial density and thread count
+void configureFluid(const SimConfig& config, const Grid3D& grid,
+                    Liquid& fluid);
+std::mt19937 makeRandom(const SimConfig& config);
+
+// writer for the record and vti outputs, or null when neither is set
+std::unique_ptr<FrameWriter> makeFrameWriter(const SimConfig& config);
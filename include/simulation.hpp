@@ -0,0 +1,69 @@
+#pragma once
+
+#include "field.hpp"
+#include "flip.hpp"
+#include "liquid.hpp"
+#include "rollback_history.hpp"
+#include "sim_config.hpp"
+#include "timestep.hpp"
+#include "tracers.hpp"
+#include "vector_math.hpp"
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <random>
+
+// one run built from a SimConfig: the grid and fluid, plus everything that
+// advances with them from frame to frame
+class Simulation {
+ public:
+  // storage can be memory-mapped to run grids larger than RAM
+  explicit Simulation(const SimConfig& simConfig,
+                      std::shared_ptr<const FieldStorage> storage = nullptr);
+
+  Simulation(const Simulation&) = delete;
+  Simulation& operator=(const Simulation&) = delete;
+  Simulation(Simulation&&) = delete;
+  Simulation& operator=(Simulation&&) = delete;
+  ~Simulation() = default;
+
+  // one frame: stirring, then as many steps as the timestep controller
+  // needs; returns the step count
+  size_t advanceFrame();
+
+  // writes what is still buffered and the final checkpoint, and rethrows
+  // the first output error
+  void finish();
+
+  // puts the fluid back to the newest recorded step at least stepsBack
+  // steps ago, or the oldest one still held, and forgets the steps after
+  // it; returns that step, or nothing when no history is kept. Tracers
+  // and the frame count carry on from where they are
+  std::optional<size_t> rewind(size_t stepsBack);
+
+  [[nodiscard]] const SimConfig& settings() const { return config; }
+  // frames and solver steps run so far, and the simulated time
+  [[nodiscard]] size_t frame() const { return frames; }
+  [[nodiscard]] size_t step() const { return steps; }
+  [[nodiscard]] float time() const { return elapsed; }
+
+  Grid3D grid;
+  Liquid fluid;
+
+ private:
+  SimConfig config;
+  TimestepController controller;
+  std::mt19937 random;
+  size_t frames = 0;
+  size_t steps = 0;
+  float elapsed = 0.0F;
+  float lastTimeStep = 0.0F;
+
+  // particles carrying the velocity, when solver = flip
+  std::unique_ptr<FlipSolver> flip;
+  // compressed copies of recent steps, when history_steps > 0
+  std::unique_ptr<RollbackHistory> history;
+  // passive particles and their trajectory file, when tracers > 0
+  std::unique_ptr<TracerSystem> tracers;
+  std::unique_ptr<TrajectoryWriter> trajectory;
+};
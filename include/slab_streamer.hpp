@@ -0,0 +1,92 @@
+#pragma once
+
+#include "field.hpp"
+#include "parallel.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// runs a kernel over the grid in z-slabs, prefetching the next slab of every
+// tracked memory-mapped field and evicting slabs the stencil has left behind
+class SlabStreamer {
+ public:
+  SlabStreamer(const Grid3D& streamGrid, size_t depth)
+      : grid(streamGrid), slabDepth(depth) {
+    // tiled slabs must cover whole tile planes or evictions would hit the
+    // tiles the next slab still needs
+    if (grid.layout == GridLayout::Tiled) {
+      slabDepth = (slabDepth + Grid3D::TILE_MASK) & ~Grid3D::TILE_MASK;
+    }
+  }
+
+  template <typename T>
+  SlabStreamer& track(const Field<T>& field) {
+    if (field.get_allocator().isMapped()) {
+      spans.push_back({field.data(), sizeof(T)});
+    }
+    return *this;
+  }
+
+  // kernel(zBegin, zEnd) must only write planes inside its slab
+  template <typename Kernel>
+  void run(Kernel&& kernel) const {
+    if (slabDepth == 0 || slabDepth >= grid.nz) {
+      kernel(size_t{0}, grid.nz);
+      return;
+    }
+
+    size_t evictedTo = 0;
+    for (size_t zBegin = 0; zBegin < grid.nz; zBegin += slabDepth) {
+      const size_t zEnd = std::min(zBegin + slabDepth, grid.nz);
+      advise(zEnd, std::min(zEnd + slabDepth, grid.nz), PageAdvice::Prefetch);
+
+      kernel(zBegin, zEnd);
+
+      // stencils read one plane back, so a slab is only dropped once the
+      // slab after it is done
+      if (zBegin > evictedTo) {
+        advise(evictedTo, zBegin, PageAdvice::Evict);
+        evictedTo = zBegin;
+      }
+    }
+    advise(evictedTo, grid.nz, PageAdvice::Evict);
+  }
+
+ private:
+  struct Span {
+    const void* data;
+    size_t elementSize;
+  };
+
+  const Grid3D& grid;
+  size_t slabDepth;
+  std::vector<Span> spans;
+
+  void advise(size_t zBegin, size_t zEnd, PageAdvice advice) const {
+    if (zBegin >= zEnd) return;
+    const auto [first, last] = grid.slabRange(zBegin, zEnd);
+    for (const Span& span : spans) {
+      adviseFieldPages(span.data, first * span.elementSize,
+                       last * span.elementSize, advice);
+    }
+  }
+};
+
+// runs kernel(x, y, z) for every cell, streaming slab by slab and splitting
+// the planes of each slab across threads; cells must be independent
+template <typename Kernel>
+void parallelForEachCell(const Grid3D& grid, const SlabStreamer& streamer,
+                         Kernel&& kernel) {
+  streamer.run([&](size_t zBegin, size_t zEnd) {
+    parallelFor(zEnd - zBegin, [&](size_t begin, size_t end) {
+      for (size_t z = zBegin + begin; z < zBegin + end; ++z) {
+        for (size_t y = 0; y < grid.ny; ++y) {
+          for (size_t x = 0; x < grid.nx; ++x) {
+            kernel(x, y, z);
+          }
+        }
+      }
+    });
+  });
+}
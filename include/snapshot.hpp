@@ -0,0 +1,94 @@
+#pragma once
+
+#include "field.hpp"
+#include "field_registry.hpp"
+#include "liquid.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// frozen copy of a field stored as fixed-size tiles of storage. Tiles the
+// solver has not written since the previous snapshot, going by the write
+// stamps the registry keeps, are shared with it, so only the tiles stages
+// wrote are duplicated and nothing is compared
+template <typename T>
+class FieldSnapshot {
+ public:
+  static constexpr size_t TILE_SHIFT = FIELD_TILE_SHIFT;
+  static constexpr size_t TILE_ELEMENTS = size_t{1} << TILE_SHIFT;
+  static constexpr size_t TILE_MASK = TILE_ELEMENTS - 1;
+
+  FieldSnapshot() = default;
+
+  FieldSnapshot(const Field<T>& field, const std::vector<uint64_t>& stamps,
+                const FieldSnapshot* previous)
+      : elements(field.size()), tileStamps(stamps) {
+    const bool comparable = previous != nullptr &&
+                            previous->size() == size() &&
+                            previous->tileStamps.size() == stamps.size();
+    const size_t tileCount = (elements + TILE_MASK) >> TILE_SHIFT;
+    tiles.reserve(tileCount);
+
+    for (size_t t = 0; t < tileCount; ++t) {
+      const size_t begin = t << TILE_SHIFT;
+      const size_t count = std::min(TILE_ELEMENTS, elements - begin);
+      const T* source = field.data() + begin;
+
+      if (comparable && previous->tileStamps[t] == stamps[t]) {
+        tiles.push_back(previous->tiles[t]);
+        ++shared;
+      } else {
+        tiles.push_back(
+            std::make_shared<const std::vector<T>>(source, source + count));
+      }
+    }
+  }
+
+  const T& operator[](size_t index) const {
+    return (*tiles[index >> TILE_SHIFT])[index & TILE_MASK];
+  }
+
+  [[nodiscard]] size_t size() const { return elements; }
+  [[nodiscard]] size_t tileCount() const { return tiles.size(); }
+  [[nodiscard]] size_t sharedTiles() const { return shared; }
+  [[nodiscard]] const std::vector<T>& tile(size_t t) const {
+    return *tiles[t];
+  }
+
+ private:
+  std::vector<std::shared_ptr<const std::vector<T>>> tiles;
+  size_t elements = 0;
+  std::vector<uint64_t> tileStamps;
+  size_t shared = 0;
+};
+
+// state of a Liquid at the end of one step
+struct LiquidSnapshot {
+  size_t step;
+  Grid3D grid;
+  FieldSnapshot<Vec3> velocity;
+  FieldSnapshot<float> density;
+  FieldSnapshot<float> pressure;
+};
+
+// hands frozen views of the solver state to consumers on other threads; a
+// consumer can keep step N while the solver runs on to N + 1
+class SnapshotPublisher {
+ public:
+  // called on the solver thread between steps
+  std::shared_ptr<const LiquidSnapshot> publish(size_t step,
+                                                const Grid3D& grid,
+                                                const Liquid& fluid);
+
+  // safe from any thread; the view stays valid for as long as it is held
+  [[nodiscard]] std::shared_ptr<const LiquidSnapshot> latest() const;
+
+ private:
+  mutable std::mutex mutex;
+  std::shared_ptr<const LiquidSnapshot> current;
+};
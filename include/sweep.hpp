@@ -0,0 +1,55 @@
+#pragma once
+
+#include "sim_config.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// values one setting takes across a sweep
+struct SweepAxis {
+  std::string key;
+  std::vector<std::string> values;
+};
+
+struct SweepRun {
+  SimConfig config;
+  std::vector<std::string> values;  // one per axis
+};
+
+// every combination of the axes applied on top of base, the first axis
+// varying slowest. Runs that record, export, checkpoint or trace get the
+// run index appended to their paths so they do not overwrite each other
+std::vector<SweepRun> expandSweep(const SimConfig& base,
+                                  const std::vector<SweepAxis>& axes);
+
+struct RunSummary {
+  double seconds;  // simulating and writing, not setup
+  uint64_t steps;
+  double densityMass;
+  float densityMin;
+  float densityMax;
+  float maxSpeed;
+  double kineticEnergy;
+};
+
+// config.frames frames with no console output, summarised at the end
+RunSummary runHeadless(const SimConfig& config);
+
+struct SweepResult {
+  bool ok = false;
+  std::string error;
+  RunSummary summary{};
+};
+
+// runs each config in its own process, at most jobs at once. The calling
+// process must not have started the parallelFor pool, since its threads
+// would not exist in the children. A run that fails or crashes is reported
+// in its result without stopping the others
+std::vector<SweepResult> runSweep(const std::vector<SweepRun>& runs,
+                                  size_t jobs, std::ostream& progress);
+
+void writeSweepCsv(std::ostream& out, const std::vector<SweepAxis>& axes,
+                   const std::vector<SweepRun>& runs,
+                   const std::vector<SweepResult>& results);
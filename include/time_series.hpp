@@ -0,0 +1,159 @@
+#pragma once
+
+#include "field.hpp"
+#include "frame_writer.hpp"
+#include "output_region.hpp"
+#include "snapshot.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// how a recording's channels are packed
+enum class SeriesCodec : uint8_t {
+  // XORed with the frame before and packed with encodeBytes. Unchanged
+  // bits XOR to zero, so slowly evolving fields shrink to long runs
+  Lossless,
+  // compressBlocks of the frame, or of its difference from the frame the
+  // reader will have decoded when that keeps every value within the
+  // tolerance
+  Blocks
+};
+
+// a recording is a 72-byte header, the frames, an index of every frame and
+// a 24-byte trailer pointing at the index. A frame holds velocity, density
+// and pressure in storage order, either whole (a keyframe) or relative to
+// the frame before, each channel packed by the header's codec. Recording a
+// whole grid keeps its storage order; a region is stored as a linear grid
+// of the cells kept
+struct SeriesHeader {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t keyframeInterval;
+  uint64_t nx, ny, nz;  // of the recorded grid
+  std::array<uint64_t, 3> origin;  // of the region in the solver grid
+  uint32_t stride;
+  uint8_t layout;
+  uint8_t codec;  // a SeriesCodec; always Lossless in version 1 files
+  std::array<uint8_t, 2> reserved;
+};
+
+struct SeriesIndexEntry {
+  uint64_t step;
+  uint64_t offset;  // of the frame record, from the start of the file
+  uint8_t keyframe;
+  std::array<uint8_t, 7> reserved;
+};
+
+struct SeriesTrailer {
+  uint64_t indexOffset;
+  uint64_t frameCount;
+  std::array<char, 8> magic;
+};
+
+static_assert(sizeof(SeriesHeader) == 72);
+static_assert(sizeof(SeriesIndexEntry) == 24);
+static_assert(sizeof(SeriesTrailer) == 24);
+
+constexpr size_t SERIES_CHANNELS = 3;
+constexpr size_t DEFAULT_KEYFRAME_INTERVAL = 32;
+
+// records the cells of region from frames handed over by a FrameWriter;
+// the header is written with the first frame, whose grid every later frame
+// must share. A tolerance above zero records with SeriesCodec::Blocks,
+// keeping every value within it
+class TimeSeriesWriter : public FrameSink {
+ public:
+  explicit TimeSeriesWriter(
+      const std::string& path,
+      size_t keyframeInterval = DEFAULT_KEYFRAME_INTERVAL,
+      OutputRegion region = {}, float tolerance = 0.0F);
+  ~TimeSeriesWriter() override;
+
+  TimeSeriesWriter(const TimeSeriesWriter&) = delete;
+  TimeSeriesWriter& operator=(const TimeSeriesWriter&) = delete;
+  TimeSeriesWriter(TimeSeriesWriter&&) = delete;
+  TimeSeriesWriter& operator=(TimeSeriesWriter&&) = delete;
+
+  void write(const LiquidSnapshot& frame) override;
+  // writes the index; later frames are rejected
+  void finish() override;
+
+  [[nodiscard]] uint64_t bytesWritten() const { return position; }
+
+ private:
+  std::ofstream file;
+  std::string filePath;
+  size_t interval;
+  OutputRegion outputRegion;
+  float errorTolerance;
+  std::array<size_t, 3> sourceSize{};
+  uint64_t position = 0;
+  bool finished = false;
+  std::vector<SeriesIndexEntry> index;
+  // bytes of the last frame, per channel, as the reader will decode them
+  std::array<std::vector<uint8_t>, SERIES_CHANNELS> previous;
+  std::array<std::vector<uint8_t>, SERIES_CHANNELS> current;
+  // cells of a region, before they are copied out as bytes
+  std::vector<Vec3> velocityCells;
+  std::vector<float> scalarCells;
+  // channels on their way through the block codec
+  Field<Vec3> velocityScratch;
+  Field<float> scalarScratch;
+  // a channel decoded from residuals, until it is known to be close enough
+  std::vector<uint8_t> candidate;
+  SeriesHeader header{};
+
+  void append(const void* data, size_t size);
+};
+
+struct SeriesFrame {
+  uint64_t step = 0;
+  Field<Vec3> velocity;
+  Field<float> density;
+  Field<float> pressure;
+};
+
+// random access to a recording; sequential reads apply one delta each,
+// while a seek decodes forward from the nearest keyframe at or before it
+class TimeSeriesReader {
+ public:
+  explicit TimeSeriesReader(const std::string& path);
+  ~TimeSeriesReader();
+
+  TimeSeriesReader(const TimeSeriesReader&) = delete;
+  TimeSeriesReader& operator=(const TimeSeriesReader&) = delete;
+  TimeSeriesReader(TimeSeriesReader&&) = delete;
+  TimeSeriesReader& operator=(TimeSeriesReader&&) = delete;
+
+  // grid of the recorded cells, and where they lie in the solver grid
+  [[nodiscard]] Grid3D grid() const;
+  [[nodiscard]] OutputRegion region() const;
+  [[nodiscard]] size_t frameCount() const { return entries.size(); }
+  [[nodiscard]] const SeriesIndexEntry& entry(size_t frame) const {
+    return entries[frame];
+  }
+  // first frame at or after step, or frameCount() if there is none
+  [[nodiscard]] size_t findStep(uint64_t step) const;
+
+  void read(size_t frame, SeriesFrame& out);
+  // asks the kernel to start paging in frames [first, first + count)
+  void prefetch(size_t first, size_t count) const;
+
+ private:
+  const uint8_t* data = nullptr;
+  size_t length = 0;
+  SeriesHeader header{};
+  std::vector<SeriesIndexEntry> entries;
+  // decoded bytes of frame `decoded`, per channel
+  std::array<std::vector<uint8_t>, SERIES_CHANNELS> state;
+  size_t decoded = SIZE_MAX;
+  Field<Vec3> velocityScratch;
+  Field<float> scalarScratch;
+
+  void apply(size_t frame);
+};
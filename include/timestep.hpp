@@ -0,0 +1,39 @@
+#pragma once
+
+#include "liquid.hpp"
+#include <cstddef>
+#include <functional>
+
+struct TimestepSettings {
+  static constexpr float DEFAULT_CFL = 1.0F;
+  static constexpr float DEFAULT_MIN_STEP = 1.0e-4F;
+  static constexpr float DEFAULT_MAX_STEP = 0.1F;
+
+  // cells the fastest parcel may cross in one step
+  float cflTarget = DEFAULT_CFL;
+  float minStep = DEFAULT_MIN_STEP;
+  float maxStep = DEFAULT_MAX_STEP;
+};
+
+// picks each step from the CFL condition so calm phases take few large
+// steps and violent ones take as many small steps as they need
+class TimestepController {
+ public:
+  explicit TimestepController(const TimestepSettings& timestepSettings = {})
+      : settings(timestepSettings) {}
+
+  // largest step that keeps the fastest parcel within the CFL target, when
+  // a force of up to acceleration speeds it up at the start of the step
+  [[nodiscard]] float stableStep(float maxSpeed,
+                                 float acceleration = 0.0F) const;
+
+  // advances exactly frameDuration with as many substeps as the flow needs,
+  // reading the fluid's speed after each one; returns the substep count.
+  // acceleration bounds the external force step applies before solving
+  size_t advance(float frameDuration, const Liquid& fluid,
+                 const std::function<void(float)>& step,
+                 float acceleration = 0.0F) const;
+
+ private:
+  TimestepSettings settings;
+};
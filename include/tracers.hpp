@@ -0,0 +1,80 @@
+#pragma once
+
+#include "bounded_queue.hpp"
+#include "field.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// passive particles that follow the flow without affecting it; positions
+// use the cell-centred coordinates of cellPosition
+class TracerSystem {
+ public:
+  std::vector<float> px, py, pz;
+
+  [[nodiscard]] size_t size() const { return px.size(); }
+
+  // scatters count tracers uniformly through the box [lower, upper)
+  void seedBox(const Vec3& lower, const Vec3& upper, size_t count,
+               uint32_t seed);
+
+  // midpoint step through the velocity field, in parallel over tracers
+  void advect(const Grid3D& grid, const Field<Vec3>& velocity,
+              float timeStep);
+};
+
+// streams tracer positions to disk on a background thread. The file is a
+// 24-byte header (magic "FSTRAJ01", uint32 version, uint32 reserved, uint64
+// tracer count) followed by one chunk per record: uint64 step, float time,
+// uint32 count, then count x, count y and count z floats, all in host byte
+// order
+class TrajectoryWriter {
+ public:
+  static constexpr uint32_t FORMAT_VERSION = 1;
+  static constexpr size_t DEFAULT_BUFFERS = 4;
+
+  TrajectoryWriter(const std::string& path, size_t count,
+                   size_t bufferCount = DEFAULT_BUFFERS);
+  ~TrajectoryWriter();
+
+  TrajectoryWriter(const TrajectoryWriter&) = delete;
+  TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+  TrajectoryWriter(TrajectoryWriter&&) = delete;
+  TrajectoryWriter& operator=(TrajectoryWriter&&) = delete;
+
+  // copies the positions into a recycled buffer and returns; only blocks
+  // when every buffer is still waiting to be written. Throws once the
+  // writer thread has failed
+  void record(size_t step, float time, const TracerSystem& tracers);
+
+  // writes every recorded chunk and rethrows the writer thread's error, if
+  // it had one; the destructor closes too but cannot report errors
+  void close();
+
+ private:
+  struct Chunk {
+    uint64_t step = 0;
+    float time = 0.0F;
+    std::vector<float> positions;  // all x, then all y, then all z
+  };
+
+  std::ofstream file;
+  size_t tracerCount;
+  BoundedQueue<std::unique_ptr<Chunk>> filled;
+  BoundedQueue<std::unique_ptr<Chunk>> spare;
+  std::thread writer;
+  bool closed = false;
+  std::mutex errorMutex;
+  std::exception_ptr error;
+
+  void writeLoop();
+  void rethrowError();
+};
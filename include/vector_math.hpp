@@ -1,49 +1,248 @@
 #pragma once
 
+#include "field.hpp"
 #include "vec3.hpp"
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstddef>
-#include <vector>
+#include <cstdint>
+#include <utility>
+
+// memory order of cells within a field
+enum class GridLayout : uint8_t {
+  Linear,  // x fastest, then y, then z
+  Tiled,   // TILE_EDGE^3 bricks stored contiguously, linear inside a brick
+  Morton   // z-order curve over the padded power-of-two extents
+};
 
 struct Grid3D {
+  static constexpr size_t TILE_SHIFT = 3;
+  static constexpr size_t TILE_EDGE = size_t{1} << TILE_SHIFT;
+  static constexpr size_t TILE_MASK = TILE_EDGE - 1;
+
   size_t nx, ny, nz;
-  Grid3D(size_t x, size_t y, size_t z) : nx(x), ny(y), nz(z) {}
+  GridLayout layout;
+
+  Grid3D(size_t x, size_t y, size_t z,
+         GridLayout gridLayout = GridLayout::Linear)
+      : nx(x),
+        ny(y),
+        nz(z),
+        layout(gridLayout),
+        tilesX((x + TILE_MASK) >> TILE_SHIFT),
+        tilesY((y + TILE_MASK) >> TILE_SHIFT),
+        storage(computeStorage()) {}
 
   [[nodiscard]] size_t idx(int x, int y, int z) const {
     x = std::clamp(x, 0, static_cast<int>(nx) - 1);
     y = std::clamp(y, 0, static_cast<int>(ny) - 1);
     z = std::clamp(z, 0, static_cast<int>(nz) - 1);
 
-    return static_cast<size_t>(x) +
-           nx * (static_cast<size_t>(y) + ny * static_cast<size_t>(z));
+    return offset(static_cast<size_t>(x), static_cast<size_t>(y),
+                  static_cast<size_t>(z));
+  }
+
+  // storage offset of an in-range cell
+  [[nodiscard]] size_t offset(size_t x, size_t y, size_t z) const {
+    switch (layout) {
+      case GridLayout::Tiled:
+        return offsetIn<GridLayout::Tiled>(x, y, z);
+      case GridLayout::Morton:
+        return offsetIn<GridLayout::Morton>(x, y, z);
+      case GridLayout::Linear:
+      default:
+        return offsetIn<GridLayout::Linear>(x, y, z);
+    }
+  }
+
+  // offset() for a layout known at compile time; L must be this grid's
+  template <GridLayout L>
+  [[nodiscard]] size_t offsetIn(size_t x, size_t y, size_t z) const {
+    if constexpr (L == GridLayout::Tiled) {
+      const size_t tile =
+          (x >> TILE_SHIFT) +
+          tilesX * ((y >> TILE_SHIFT) + tilesY * (z >> TILE_SHIFT));
+      const size_t local =
+          (x & TILE_MASK) +
+          TILE_EDGE * ((y & TILE_MASK) + TILE_EDGE * (z & TILE_MASK));
+      return (tile << (3 * TILE_SHIFT)) + local;
+    } else if constexpr (L == GridLayout::Morton) {
+      return static_cast<size_t>(spreadBits(x) | (spreadBits(y) << 1U) |
+                                 (spreadBits(z) << 2U));
+    } else {
+      return x + nx * (y + ny * z);
+    }
   }
 
-  [[nodiscard]] size_t size() const { return nx * ny * nz; }
+  // number of elements a field on this grid must hold, including the padding
+  // the tiled and morton layouts need to round out partial tiles
+  [[nodiscard]] size_t size() const { return storage; }
+
+  // number of real cells
+  [[nodiscard]] size_t cellCount() const { return nx * ny * nz; }
+
+  // storage range holding z-planes [zBegin, zEnd), widened to whole tiles;
+  // morton slabs are scattered through the field, so theirs is empty
+  [[nodiscard]] std::pair<size_t, size_t> slabRange(size_t zBegin,
+                                                    size_t zEnd) const {
+    switch (layout) {
+      case GridLayout::Tiled: {
+        const size_t tilePlane = tilesX * tilesY << (3 * TILE_SHIFT);
+        return {(zBegin >> TILE_SHIFT) * tilePlane,
+                ((zEnd + TILE_MASK) >> TILE_SHIFT) * tilePlane};
+      }
+      case GridLayout::Morton:
+        return {0, 0};
+      case GridLayout::Linear:
+      default:
+        return {nx * ny * zBegin, nx * ny * zEnd};
+    }
+  }
+
+ private:
+  size_t tilesX, tilesY;
+  size_t storage;
+
+  // insert two zero bits between each of the low 21 bits
+  static uint64_t spreadBits(size_t value) {
+    auto v = static_cast<uint64_t>(value) & 0x1fffffU;
+    v = (v | v << 32U) & 0x1f00000000ffffU;
+    v = (v | v << 16U) & 0x1f0000ff0000ffU;
+    v = (v | v << 8U) & 0x100f00f00f00f00fU;
+    v = (v | v << 4U) & 0x10c30c30c30c30c3U;
+    v = (v | v << 2U) & 0x1249249249249249U;
+    return v;
+  }
+
+  [[nodiscard]] size_t computeStorage() const {
+    switch (layout) {
+      case GridLayout::Tiled:
+        return tilesX * tilesY * ((nz + TILE_MASK) >> TILE_SHIFT)
+               << (3 * TILE_SHIFT);
+      case GridLayout::Morton:
+        // codes are dense over the power-of-two extents, so the last cell of
+        // the padded box bounds every offset; very flat grids waste space
+        if (nx == 0 || ny == 0 || nz == 0) return 0;
+        return offset(bitCeil(nx) - 1, bitCeil(ny) - 1, bitCeil(nz) - 1) + 1;
+      case GridLayout::Linear:
+      default:
+        return nx * ny * nz;
+    }
+  }
+
+  static size_t bitCeil(size_t value) {
+    size_t result = 1;
+    while (result < value) result <<= 1U;
+    return result;
+  }
 };
 
+// a grid whose layout is fixed at compile time. Kernels instantiated for
+// one compute every offset inline, instead of switching on the layout for
+// each cell as Grid3D::idx does; withLayout picks the instantiation
+template <GridLayout L>
+struct LayoutGrid {
+  const Grid3D& grid;
+  size_t nx, ny, nz;
+
+  explicit LayoutGrid(const Grid3D& base)
+      : grid(base), nx(base.nx), ny(base.ny), nz(base.nz) {}
+
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  operator const Grid3D&() const { return grid; }
+
+  [[nodiscard]] size_t idx(int x, int y, int z) const {
+    x = std::clamp(x, 0, static_cast<int>(nx) - 1);
+    y = std::clamp(y, 0, static_cast<int>(ny) - 1);
+    z = std::clamp(z, 0, static_cast<int>(nz) - 1);
+
+    return offset(static_cast<size_t>(x), static_cast<size_t>(y),
+                  static_cast<size_t>(z));
+  }
+
+  [[nodiscard]] size_t offset(size_t x, size_t y, size_t z) const {
+    return grid.offsetIn<L>(x, y, z);
+  }
+};
+
+// calls fn with grid as the LayoutGrid of its layout, so the layout is
+// switched on once per call rather than once per cell
+template <typename Fn>
+decltype(auto) withLayout(const Grid3D& grid, Fn&& fn) {
+  switch (grid.layout) {
+    case GridLayout::Tiled:
+      return fn(LayoutGrid<GridLayout::Tiled>(grid));
+    case GridLayout::Morton:
+      return fn(LayoutGrid<GridLayout::Morton>(grid));
+    case GridLayout::Linear:
+    default:
+      return fn(LayoutGrid<GridLayout::Linear>(grid));
+  }
+}
+
+// component-wise helpers so kernels can treat scalar and vector fields alike
+inline float componentMin(float a, float b) { return std::min(a, b); }
+inline float componentMax(float a, float b) { return std::max(a, b); }
+inline float componentClamp(float value, float lower, float upper) {
+  return std::clamp(value, lower, upper);
+}
+
+inline float componentMaxAbs(float value) { return std::fabs(value); }
+
+inline Vec3 componentMin(const Vec3& a, const Vec3& b) {
+  return {std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)};
+}
+inline Vec3 componentMax(const Vec3& a, const Vec3& b) {
+  return {std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)};
+}
+inline Vec3 componentClamp(const Vec3& value, const Vec3& lower,
+                           const Vec3& upper) {
+  return {std::clamp(value.x, lower.x, upper.x),
+          std::clamp(value.y, lower.y, upper.y),
+          std::clamp(value.z, lower.z, upper.z)};
+}
+inline float componentMaxAbs(const Vec3& value) {
+  return std::max({std::fabs(value.x), std::fabs(value.y), std::fabs(value.z)});
+}
+
 // linear interpolation
 template <typename T>
 T linearInterpolate(const T& a, const T& b, float t) {
   return a * (1 - t) + b * t;
 }
 
-// trilinear interpolation
-template <typename T>
-T trilinearInterpolate(const Grid3D& grid, const std::vector<T>& field,
-                       const Vec3& pos) {
+// base cell and weights of one trilinear sample, so the floor and weight
+// computation can be shared by every field sampled at the same position
+struct SamplePoint {
+  int x0 = 0, y0 = 0, z0 = 0;
+  float u = 0.0F, v = 0.0F, w = 0.0F;
+};
+
+inline SamplePoint samplePoint(const Vec3& pos) {
+  SamplePoint sample;
   // integer corner indices
-  int x0 = static_cast<int>(std::floor(pos.x));
-  int x1 = x0 + 1;
-  int y0 = static_cast<int>(std::floor(pos.y));
-  int y1 = y0 + 1;
-  int z0 = static_cast<int>(std::floor(pos.z));
-  int z1 = z0 + 1;
+  sample.x0 = static_cast<int>(std::floor(pos.x));
+  sample.y0 = static_cast<int>(std::floor(pos.y));
+  sample.z0 = static_cast<int>(std::floor(pos.z));
 
   // interpolation weights
-  float u = pos.x - static_cast<float>(x0);
-  float v = pos.y - static_cast<float>(y0);
-  float w = pos.z - static_cast<float>(z0);
+  sample.u = pos.x - static_cast<float>(sample.x0);
+  sample.v = pos.y - static_cast<float>(sample.y0);
+  sample.w = pos.z - static_cast<float>(sample.z0);
+  return sample;
+}
+
+// trilinear interpolation; grid is a Grid3D or a LayoutGrid
+template <typename Grid, typename T>
+T trilinearInterpolate(const Grid& grid, const Field<T>& field,
+                       const SamplePoint& sample) {
+  const int x0 = sample.x0;
+  const int x1 = x0 + 1;
+  const int y0 = sample.y0;
+  const int y1 = y0 + 1;
+  const int z0 = sample.z0;
+  const int z1 = z0 + 1;
 
   // get field values
   T f000 = field[grid.idx(x0, y0, z0)];
@@ -56,13 +255,71 @@ T trilinearInterpolate(const Grid3D& grid, const std::vector<T>& field,
   T f111 = field[grid.idx(x1, y1, z1)];
 
   // trilinear interpolation
-  T f00 = linearInterpolate(f000, f100, u);
-  T f10 = linearInterpolate(f010, f110, u);
-  T f01 = linearInterpolate(f001, f101, u);
-  T f11 = linearInterpolate(f011, f111, u);
+  T f00 = linearInterpolate(f000, f100, sample.u);
+  T f10 = linearInterpolate(f010, f110, sample.u);
+  T f01 = linearInterpolate(f001, f101, sample.u);
+  T f11 = linearInterpolate(f011, f111, sample.u);
+
+  T f0 = linearInterpolate(f00, f10, sample.v);
+  T f1 = linearInterpolate(f01, f11, sample.v);
 
-  T f0 = linearInterpolate(f00, f10, v);
-  T f1 = linearInterpolate(f01, f11, v);
+  return linearInterpolate(f0, f1, sample.w);
+}
+
+template <typename Grid, typename T>
+T trilinearInterpolate(const Grid& grid, const Field<T>& field,
+                       const Vec3& pos) {
+  return trilinearInterpolate(grid, field, samplePoint(pos));
+}
 
-  return linearInterpolate(f0, f1, w);
+// smallest and largest of the eight samples trilinearInterpolate blends
+template <typename Grid, typename T>
+void trilinearBounds(const Grid& grid, const Field<T>& field,
+                     const SamplePoint& sample, T& lower, T& upper) {
+  lower = upper = field[grid.idx(sample.x0, sample.y0, sample.z0)];
+  for (int dz = 0; dz <= 1; ++dz) {
+    for (int dy = 0; dy <= 1; ++dy) {
+      for (int dx = 0; dx <= 1; ++dx) {
+        const T& value =
+            field[grid.idx(sample.x0 + dx, sample.y0 + dy, sample.z0 + dz)];
+        lower = componentMin(lower, value);
+        upper = componentMax(upper, value);
+      }
+    }
+  }
+}
+
+// samples a vector field at count positions given as separate coordinate
+// arrays; the weight arithmetic runs as straight loops over the batch so
+// it vectorises, leaving only the eight gathers per point scalar
+inline void trilinearInterpolateBatch(const Grid3D& grid,
+                                      const Field<Vec3>& field,
+                                      const float* px, const float* py,
+                                      const float* pz, size_t count,
+                                      Vec3* out) {
+  constexpr size_t BATCH = 64;
+  std::array<float, BATCH> fx{}, fy{}, fz{}, u{}, v{}, w{};
+
+  for (size_t begin = 0; begin < count; begin += BATCH) {
+    const size_t n = std::min(BATCH, count - begin);
+
+    for (size_t i = 0; i < n; ++i) {
+      fx[i] = std::floor(px[begin + i]);
+      fy[i] = std::floor(py[begin + i]);
+      fz[i] = std::floor(pz[begin + i]);
+      u[i] = px[begin + i] - fx[i];
+      v[i] = py[begin + i] - fy[i];
+      w[i] = pz[begin + i] - fz[i];
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      const SamplePoint sample{static_cast<int>(fx[i]),
+                               static_cast<int>(fy[i]),
+                               static_cast<int>(fz[i]),
+                               u[i],
+                               v[i],
+                               w[i]};
+      out[begin + i] = trilinearInterpolate(grid, field, sample);
+    }
+  }
 }
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "frame_writer.hpp"
+#include "output_region.hpp"
+#include "snapshot.hpp"
+#include "vec3.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// writes each frame as a VTK XML ImageData file, <prefix>_<step>.vti, for
+// ParaView. Velocity, density and pressure are cell data in raw appended
+// binary, so a frame is the XML header plus the fields written as they are
+// in memory; nothing is formatted per value. Only the cells of region are
+// written, placed at their position in the full grid
+class VtiWriter : public FrameSink {
+ public:
+  explicit VtiWriter(std::string prefix, OutputRegion region = {});
+
+  void write(const LiquidSnapshot& frame) override;
+  void finish() override {}
+
+  [[nodiscard]] std::string framePath(size_t step) const;
+
+ private:
+  std::string pathPrefix;
+  OutputRegion outputRegion;
+  // VTK wants x-fastest order; regions and tiled or morton fields are
+  // gathered into these, which keep their capacity from frame to frame
+  std::vector<Vec3> velocityBuffer;
+  std::vector<float> densityBuffer;
+  std::vector<float> pressureBuffer;
+};
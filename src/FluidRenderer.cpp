@@ -2,6 +2,9 @@
 
 #include "RenderPipeline.hpp"
 #include "liquid.hpp"
+#include "snapshot.hpp"
+#include "vec3.hpp"
+#include <cmath>
 #include <vector>
 
 constexpr float LEFT = -1.0F;
@@ -38,7 +41,12 @@ FluidRenderer::FluidRenderer(Grid3D& grid)
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 }
 
-void FluidRenderer::updateSlice(const Liquid& fluid, Grid3D& grid) const {
+namespace {
+
+// normalised speed on the mid z slice of any indexable velocity field
+template <typename VelocityField>
+std::vector<float> speedSlice(const VelocityField& velocity,
+                              const Grid3D& grid) {
   std::vector<float> sliceArray(grid.nx * grid.ny);
 
   float maxSpeed = 0.0f;
@@ -47,7 +55,7 @@ void FluidRenderer::updateSlice(const Liquid& fluid, Grid3D& grid) const {
       const int ix = static_cast<int>(x), iy = static_cast<int>(y);
       const int iz = static_cast<int>(grid.nz) / 2;
 
-      Vec3 vel = fluid.velocity[grid.idx(ix, iy, iz)];
+      Vec3 vel = velocity[grid.idx(ix, iy, iz)];
       float speed = std::sqrt(vel.x * vel.x + vel.y * vel.y + vel.z * vel.z);
       if (speed > maxSpeed) maxSpeed = speed;
     }
@@ -58,12 +66,31 @@ void FluidRenderer::updateSlice(const Liquid& fluid, Grid3D& grid) const {
       const int ix = static_cast<int>(x);
       const int iy = static_cast<int>(y);
       const int iz = static_cast<int>(grid.nz) / 2;
-      Vec3 vel = fluid.velocity[grid.idx(ix, iy, iz)];
+      Vec3 vel = velocity[grid.idx(ix, iy, iz)];
       float speed = std::sqrt(vel.x * vel.x + vel.y * vel.y + vel.z * vel.z);
       sliceArray[y * grid.nx + x] = speed / (maxSpeed + 1e-6f);
     }
   }
+  return sliceArray;
+}
+
+}  // namespace
+
+void FluidRenderer::updateSlice(const Liquid& fluid, Grid3D& grid) const {
+  uploadSlice(speedSlice(fluid.velocity, grid), grid);
+}
+
+void FluidRenderer::updateSlice(const LiquidSnapshot& snapshot) const {
+  uploadSlice(speedSlice(snapshot.velocity, snapshot.grid), snapshot.grid);
+}
+
+void FluidRenderer::updateSlice(const Vec3* velocity,
+                                const Grid3D& grid) const {
+  uploadSlice(speedSlice(velocity, grid), grid);
+}
 
+void FluidRenderer::uploadSlice(const std::vector<float>& sliceArray,
+                                const Grid3D& grid) const {
   glBindTexture(GL_TEXTURE_2D, textureID);
 
   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, static_cast<GLsizei>(grid.nx),
@@ -0,0 +1,482 @@
+#include "block_compression.hpp"
+
+#include "compression.hpp"
+#include "field.hpp"
+#include "parallel.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+constexpr size_t BLOCK_EDGE = 4;
+constexpr size_t BLOCK_VALUES = BLOCK_EDGE * BLOCK_EDGE * BLOCK_EDGE;
+// bits of the per-block width fields
+constexpr unsigned WIDTH_BITS = 6;
+
+enum class BlockMode : uint8_t { Lossless = 0, Blocks = 1 };
+
+using Block = std::array<int64_t, BLOCK_VALUES>;
+
+// after lifting, index 0 along an axis holds the mean, 1 the coarse
+// difference and 2, 3 the fine ones; coefficients are grouped by the sum
+// of those levels over the three axes, and each group is packed at its own
+// width, since fine detail is usually much smaller than coarse
+constexpr size_t GROUPS = 7;
+
+constexpr std::array<uint8_t, BLOCK_VALUES> coefficientGroups() {
+  constexpr std::array<uint8_t, BLOCK_EDGE> LEVEL = {0, 1, 2, 2};
+  std::array<uint8_t, BLOCK_VALUES> groups{};
+  for (size_t i = 0; i < BLOCK_VALUES; ++i) {
+    groups[i] = static_cast<uint8_t>(
+        LEVEL[i % BLOCK_EDGE] + LEVEL[(i / BLOCK_EDGE) % BLOCK_EDGE] +
+        LEVEL[i / (BLOCK_EDGE * BLOCK_EDGE)]);
+  }
+  return groups;
+}
+
+constexpr std::array<uint8_t, BLOCK_VALUES> COEFFICIENT_GROUP =
+    coefficientGroups();
+
+uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1U) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1U) ^ -static_cast<int64_t>(value & 1U);
+}
+
+unsigned bitWidth(uint64_t value) {
+  unsigned width = 0;
+  while (value != 0) {
+    ++width;
+    value >>= 1U;
+  }
+  return width;
+}
+
+class BitWriter {
+ public:
+  explicit BitWriter(std::vector<uint8_t>& output) : out(output) {}
+
+  void write(uint64_t value, unsigned bits) {
+    for (unsigned written = 0; written < bits;) {
+      const unsigned take = std::min(bits - written, 64 - filled);
+      const uint64_t part =
+          take == 64 ? value : (value >> written) & ((uint64_t{1} << take) - 1);
+      buffer |= part << filled;
+      filled += take;
+      written += take;
+      if (filled == 64) flushWord();
+    }
+  }
+
+  void finish() {
+    for (unsigned byte = 0; byte * 8 < filled; ++byte) {
+      out.push_back(static_cast<uint8_t>(buffer >> (8 * byte)));
+    }
+    buffer = 0;
+    filled = 0;
+  }
+
+ private:
+  std::vector<uint8_t>& out;
+  uint64_t buffer = 0;
+  unsigned filled = 0;
+
+  void flushWord() {
+    for (unsigned byte = 0; byte < 8; ++byte) {
+      out.push_back(static_cast<uint8_t>(buffer >> (8 * byte)));
+    }
+    buffer = 0;
+    filled = 0;
+  }
+};
+
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, size_t size) : in(data), end(data + size) {}
+
+  uint64_t read(unsigned bits) {
+    uint64_t value = 0;
+    for (unsigned got = 0; got < bits;) {
+      if (available == 0) refill();
+      const unsigned take = std::min(bits - got, available);
+      const uint64_t part =
+          take == 64 ? buffer : buffer & ((uint64_t{1} << take) - 1);
+      value |= part << got;
+      buffer = take == 64 ? 0 : buffer >> take;
+      available -= take;
+      got += take;
+    }
+    return value;
+  }
+
+ private:
+  const uint8_t* in;
+  const uint8_t* end;
+  uint64_t buffer = 0;
+  unsigned available = 0;
+
+  void refill() {
+    if (in == end) {
+      throw std::runtime_error("Compressed block stream is truncated");
+    }
+    buffer = 0;
+    available = 0;
+    while (in != end && available < 64) {
+      buffer |= static_cast<uint64_t>(*in++) << available;
+      available += 8;
+    }
+  }
+};
+
+// two levels of the integer S-transform on four values; exactly
+// reversible, and smooth data leaves small differences
+void forwardLift(int64_t& a0, int64_t& a1, int64_t& a2, int64_t& a3) {
+  const int64_t d0 = a1 - a0;
+  const int64_t s0 = a0 + (d0 >> 1);
+  const int64_t d1 = a3 - a2;
+  const int64_t s1 = a2 + (d1 >> 1);
+  const int64_t dd = s1 - s0;
+  a0 = s0 + (dd >> 1);
+  a1 = dd;
+  a2 = d0;
+  a3 = d1;
+}
+
+void inverseLift(int64_t& a0, int64_t& a1, int64_t& a2, int64_t& a3) {
+  const int64_t s0 = a0 - (a1 >> 1);
+  const int64_t s1 = a1 + s0;
+  const int64_t d0 = a2;
+  const int64_t d1 = a3;
+  a0 = s0 - (d0 >> 1);
+  a1 = d0 + a0;
+  a2 = s1 - (d1 >> 1);
+  a3 = d1 + a2;
+}
+
+// lifts along x, y and z in turn; stride picks the axis
+template <typename Lift>
+void transformBlock(Block& block, Lift lift) {
+  const std::array<size_t, 3> strides = {1, BLOCK_EDGE,
+                                         BLOCK_EDGE * BLOCK_EDGE};
+  for (size_t axis = 0; axis < 3; ++axis) {
+    const size_t stride = strides[axis];
+    for (size_t line = 0; line < BLOCK_EDGE * BLOCK_EDGE; ++line) {
+      // first element of the line: skip the axis' own coordinate
+      const size_t low = line % stride;
+      const size_t high = line / stride;
+      const size_t first = low + high * stride * BLOCK_EDGE;
+      lift(block[first], block[first + stride], block[first + 2 * stride],
+           block[first + 3 * stride]);
+    }
+  }
+}
+
+void inverseTransformBlock(Block& block) {
+  const std::array<size_t, 3> strides = {BLOCK_EDGE * BLOCK_EDGE, BLOCK_EDGE,
+                                         1};
+  for (size_t stride : strides) {
+    for (size_t line = 0; line < BLOCK_EDGE * BLOCK_EDGE; ++line) {
+      const size_t low = line % stride;
+      const size_t high = line / stride;
+      const size_t first = low + high * stride * BLOCK_EDGE;
+      inverseLift(block[first], block[first + stride],
+                  block[first + 2 * stride], block[first + 3 * stride]);
+    }
+  }
+}
+
+struct BlockGrid {
+  size_t x, y, z;
+
+  explicit BlockGrid(const Grid3D& grid)
+      : x((grid.nx + BLOCK_EDGE - 1) / BLOCK_EDGE),
+        y((grid.ny + BLOCK_EDGE - 1) / BLOCK_EDGE),
+        z((grid.nz + BLOCK_EDGE - 1) / BLOCK_EDGE) {}
+};
+
+// gathers one component of a block; cells past the grid edge repeat the
+// last cell so partial blocks stay smooth
+template <typename Get>
+void gatherBlock(const Grid3D& grid, size_t bx, size_t by, size_t bz,
+                 const Get& get, double scale, Block& block) {
+  for (size_t k = 0; k < BLOCK_EDGE; ++k) {
+    const size_t z = std::min(bz * BLOCK_EDGE + k, grid.nz - 1);
+    for (size_t j = 0; j < BLOCK_EDGE; ++j) {
+      const size_t y = std::min(by * BLOCK_EDGE + j, grid.ny - 1);
+      for (size_t i = 0; i < BLOCK_EDGE; ++i) {
+        const size_t x = std::min(bx * BLOCK_EDGE + i, grid.nx - 1);
+        const double value = static_cast<double>(get(grid.offset(x, y, z)));
+        block[i + BLOCK_EDGE * (j + BLOCK_EDGE * k)] =
+            static_cast<int64_t>(std::round(value * scale));
+      }
+    }
+  }
+}
+
+// largest magnitude of any cell, or infinity if one is not finite
+template <typename Get>
+double largestMagnitude(const Grid3D& grid, const Get& get) {
+  double largest = 0.0;
+  for (size_t z = 0; z < grid.nz; ++z) {
+    for (size_t y = 0; y < grid.ny; ++y) {
+      for (size_t x = 0; x < grid.nx; ++x) {
+        const float value = get(grid.offset(x, y, z));
+        if (!std::isfinite(value)) return HUGE_VAL;
+        largest = std::max(largest, std::fabs(static_cast<double>(value)));
+      }
+    }
+  }
+  return largest;
+}
+
+float& componentOf(Vec3& value, size_t component) {
+  if (component == 0) return value.x;
+  return component == 1 ? value.y : value.z;
+}
+
+template <typename T>
+void putValue(std::vector<uint8_t>& out, T value) {
+  const size_t at = out.size();
+  out.resize(at + sizeof(T));
+  std::memcpy(out.data() + at, &value, sizeof(T));
+}
+
+template <typename T>
+T getValue(const std::vector<uint8_t>& in, size_t& at) {
+  if (at + sizeof(T) > in.size()) {
+    throw std::runtime_error("Compressed block stream is truncated");
+  }
+  T value;
+  std::memcpy(&value, in.data() + at, sizeof(T));
+  at += sizeof(T);
+  return value;
+}
+
+// one scalar component: mode byte, then either the lossless codec over the
+// cells in x-fastest order, or the bin width, the chunk count, each chunk's
+// size and the chunks
+template <typename Get>
+std::vector<uint8_t> compressComponent(const Grid3D& grid, const Get& get,
+                                       float tolerance, float base) {
+  const double binWidth =
+      tolerance > 0.0F
+          ? quantiserBinWidth(largestMagnitude(grid, get), tolerance, base)
+          : 0.0;
+  std::vector<uint8_t> out;
+
+  if (binWidth <= 0.0) {
+    std::vector<float> cells;
+    cells.reserve(grid.cellCount());
+    for (size_t z = 0; z < grid.nz; ++z) {
+      for (size_t y = 0; y < grid.ny; ++y) {
+        for (size_t x = 0; x < grid.nx; ++x) {
+          cells.push_back(get(grid.offset(x, y, z)));
+        }
+      }
+    }
+    out = encodeBytes(cells.data(), cells.size() * sizeof(float),
+                      sizeof(float));
+    out.insert(out.begin(), static_cast<uint8_t>(BlockMode::Lossless));
+    return out;
+  }
+
+  const double scale = 1.0 / binWidth;
+  const BlockGrid blocks(grid);
+  std::vector<std::vector<uint8_t>> chunks(blocks.z);
+  parallelFor(blocks.z, [&](size_t begin, size_t end) {
+    Block block{};
+    for (size_t bz = begin; bz < end; ++bz) {
+      BitWriter bits(chunks[bz]);
+      int64_t previousDc = 0;
+      for (size_t by = 0; by < blocks.y; ++by) {
+        for (size_t bx = 0; bx < blocks.x; ++bx) {
+          gatherBlock(grid, bx, by, bz, get, scale, block);
+          transformBlock(block, forwardLift);
+
+          // the mean is coded against the previous block's, every other
+          // group at the width of its largest coefficient
+          const uint64_t dc = zigzag(block[0] - previousDc);
+          previousDc = block[0];
+          std::array<uint64_t, GROUPS> largest{};
+          for (size_t i = 1; i < BLOCK_VALUES; ++i) {
+            uint64_t& top = largest[COEFFICIENT_GROUP[i]];
+            top = std::max(top, zigzag(block[i]));
+          }
+
+          const unsigned dcWidth = bitWidth(dc);
+          bits.write(dcWidth, WIDTH_BITS);
+          bits.write(dc, dcWidth);
+          std::array<unsigned, GROUPS> widths{};
+          for (size_t g = 1; g < GROUPS; ++g) {
+            widths[g] = bitWidth(largest[g]);
+            bits.write(widths[g], WIDTH_BITS);
+          }
+          for (size_t i = 1; i < BLOCK_VALUES; ++i) {
+            bits.write(zigzag(block[i]), widths[COEFFICIENT_GROUP[i]]);
+          }
+        }
+      }
+      bits.finish();
+    }
+  });
+
+  out.push_back(static_cast<uint8_t>(BlockMode::Blocks));
+  putValue(out, binWidth);
+  putValue(out, static_cast<uint32_t>(chunks.size()));
+  for (const auto& chunk : chunks) {
+    putValue(out, static_cast<uint64_t>(chunk.size()));
+  }
+  for (const auto& chunk : chunks) {
+    out.insert(out.end(), chunk.begin(), chunk.end());
+  }
+  return out;
+}
+
+template <typename Set>
+void decompressComponent(const Grid3D& grid,
+                         const std::vector<uint8_t>& encoded, size_t at,
+                         size_t size, const Set& set) {
+  if (size == 0) {
+    throw std::runtime_error("Compressed field is empty");
+  }
+  const auto mode = static_cast<BlockMode>(encoded[at]);
+  ++at;
+
+  if (mode == BlockMode::Lossless) {
+    const std::vector<uint8_t> payload(
+        encoded.begin() + static_cast<ptrdiff_t>(at),
+        encoded.begin() + static_cast<ptrdiff_t>(at + size - 1));
+    std::vector<float> cells(grid.cellCount());
+    decodeBytes(payload, cells.data(), cells.size() * sizeof(float),
+                sizeof(float));
+    size_t i = 0;
+    for (size_t z = 0; z < grid.nz; ++z) {
+      for (size_t y = 0; y < grid.ny; ++y) {
+        for (size_t x = 0; x < grid.nx; ++x) {
+          set(grid.offset(x, y, z), cells[i++]);
+        }
+      }
+    }
+    return;
+  }
+
+  const auto binWidth = getValue<double>(encoded, at);
+  const auto chunkCount = getValue<uint32_t>(encoded, at);
+  const BlockGrid blocks(grid);
+  if (chunkCount != blocks.z) {
+    throw std::runtime_error("Compressed field has a different grid");
+  }
+  std::vector<size_t> offsets(chunkCount + 1);
+  offsets[0] = at + chunkCount * sizeof(uint64_t);
+  for (size_t c = 0; c < chunkCount; ++c) {
+    offsets[c + 1] =
+        offsets[c] + static_cast<size_t>(getValue<uint64_t>(encoded, at));
+  }
+  if (offsets.back() > encoded.size()) {
+    throw std::runtime_error("Compressed block stream is truncated");
+  }
+
+  parallelFor(chunkCount, [&](size_t begin, size_t end) {
+    Block block{};
+    for (size_t bz = begin; bz < end; ++bz) {
+      BitReader bits(encoded.data() + offsets[bz],
+                     offsets[bz + 1] - offsets[bz]);
+      int64_t previousDc = 0;
+      for (size_t by = 0; by < blocks.y; ++by) {
+        for (size_t bx = 0; bx < blocks.x; ++bx) {
+          const auto dcWidth = static_cast<unsigned>(bits.read(WIDTH_BITS));
+          block[0] = previousDc + unzigzag(bits.read(dcWidth));
+          previousDc = block[0];
+          std::array<unsigned, GROUPS> widths{};
+          for (size_t g = 1; g < GROUPS; ++g) {
+            widths[g] = static_cast<unsigned>(bits.read(WIDTH_BITS));
+          }
+          for (size_t i = 1; i < BLOCK_VALUES; ++i) {
+            block[i] = unzigzag(bits.read(widths[COEFFICIENT_GROUP[i]]));
+          }
+          inverseTransformBlock(block);
+
+          for (size_t k = 0; k < BLOCK_EDGE; ++k) {
+            const size_t z = bz * BLOCK_EDGE + k;
+            for (size_t j = 0; j < BLOCK_EDGE; ++j) {
+              const size_t y = by * BLOCK_EDGE + j;
+              for (size_t i = 0; i < BLOCK_EDGE; ++i) {
+                const size_t x = bx * BLOCK_EDGE + i;
+                if (x >= grid.nx || y >= grid.ny || z >= grid.nz) continue;
+                const auto bin = static_cast<double>(
+                    block[i + BLOCK_EDGE * (j + BLOCK_EDGE * k)]);
+                set(grid.offset(x, y, z), static_cast<float>(bin * binWidth));
+              }
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+}  // namespace
+
+std::vector<uint8_t> compressBlocks(const Grid3D& grid,
+                                    const Field<float>& field,
+                                    float tolerance, float base) {
+  return compressComponent(
+      grid, [&](size_t index) { return field[index]; }, tolerance, base);
+}
+
+void decompressBlocks(const Grid3D& grid, const std::vector<uint8_t>& encoded,
+                      Field<float>& field) {
+  field.resize(grid.size());
+  decompressComponent(grid, encoded, 0, encoded.size(),
+                      [&](size_t index, float value) { field[index] = value; });
+}
+
+std::vector<uint8_t> compressBlocks(const Grid3D& grid,
+                                    const Field<Vec3>& field,
+                                    float tolerance, float base) {
+  const std::array<std::vector<uint8_t>, 3> components = {
+      compressComponent(
+          grid, [&](size_t index) { return field[index].x; }, tolerance,
+          base),
+      compressComponent(
+          grid, [&](size_t index) { return field[index].y; }, tolerance,
+          base),
+      compressComponent(
+          grid, [&](size_t index) { return field[index].z; }, tolerance,
+          base)};
+
+  std::vector<uint8_t> out;
+  for (const auto& component : components) {
+    putValue(out, static_cast<uint64_t>(component.size()));
+    out.insert(out.end(), component.begin(), component.end());
+  }
+  return out;
+}
+
+void decompressBlocks(const Grid3D& grid, const std::vector<uint8_t>& encoded,
+                      Field<Vec3>& field) {
+  field.resize(grid.size());
+  size_t at = 0;
+  for (size_t component = 0; component < 3; ++component) {
+    const auto size = static_cast<size_t>(getValue<uint64_t>(encoded, at));
+    if (at + size > encoded.size()) {
+      throw std::runtime_error("Compressed block stream is truncated");
+    }
+    decompressComponent(grid, encoded, at, size,
+                        [&](size_t index, float value) {
+                          componentOf(field[index], component) = value;
+                        });
+    at += size;
+  }
+}
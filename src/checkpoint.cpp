@@ -0,0 +1,293 @@
+#include "checkpoint.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "field.hpp"
+#include "field_registry.hpp"
+#include "liquid.hpp"
+#include "mac_grid.hpp"
+#include "refinement.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+constexpr std::array<char, 8> CHECKPOINT_MAGIC = {'F', 'S', 'C', 'K',
+                                                  'P', 'T', '0', '1'};
+
+std::runtime_error systemError(const std::string& what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+size_t alignUp(size_t bytes) {
+  return (bytes + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT *
+         CHECKPOINT_ALIGNMENT;
+}
+
+}  // namespace
+
+void writeAll(int fd, std::vector<iovec>& buffers) {
+  size_t first = 0;
+  while (first < buffers.size()) {
+    const int count = static_cast<int>(
+        std::min<size_t>(buffers.size() - first, IOV_MAX));
+    ssize_t written = writev(fd, &buffers[first], count);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      throw systemError("Cannot write file");
+    }
+    auto remaining = static_cast<size_t>(written);
+    while (first < buffers.size() && remaining >= buffers[first].iov_len) {
+      remaining -= buffers[first].iov_len;
+      ++first;
+    }
+    if (remaining > 0) {
+      buffers[first].iov_base =
+          static_cast<char*>(buffers[first].iov_base) + remaining;
+      buffers[first].iov_len -= remaining;
+    }
+  }
+}
+
+void writeCheckpoint(const std::string& path, const Grid3D& grid,
+                     const Liquid& fluid, uint64_t step, float timeStep) {
+  // writev only reads it, but iovec wants a mutable pointer
+  static std::array<char, CHECKPOINT_ALIGNMENT> padding{};
+
+  CheckpointHeader header{};
+  header.magic = CHECKPOINT_MAGIC;
+  header.version = CHECKPOINT_VERSION;
+  header.nx = grid.nx;
+  header.ny = grid.ny;
+  header.nz = grid.nz;
+  header.step = step;
+  header.timeStep = timeStep;
+  header.viscosity = fluid.viscosity;
+  header.diffusionRate = fluid.diffusionRate;
+  header.layout = static_cast<uint8_t>(grid.layout);
+  header.velocityLayout = static_cast<uint8_t>(fluid.velocityLayout);
+  header.densityRefinement = static_cast<uint8_t>(fluid.densityRefinement);
+
+  // descriptors first, so the payload offsets are known before any data
+  std::vector<CheckpointField> descriptors;
+  std::vector<iovec> payloads;
+  fluid.fields.forEachField(
+      [&](const std::string& name, FieldLifetime lifetime,
+          const auto& field) {
+        if (lifetime != FieldLifetime::Persistent) return;
+        if (name.size() >= sizeof(CheckpointField::name)) {
+          throw std::runtime_error("Field name too long to checkpoint: " +
+                                   name);
+        }
+        CheckpointField descriptor{};
+        std::copy(name.begin(), name.end(), descriptor.name.begin());
+        descriptor.elementSize = sizeof(field[0]);
+        descriptor.elementCount = field.size();
+        descriptors.push_back(descriptor);
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+        payloads.push_back({const_cast<void*>(static_cast<const void*>(
+                                field.data())),
+                            field.size() * sizeof(field[0])});
+      });
+  header.fieldCount = static_cast<uint32_t>(descriptors.size());
+
+  size_t offset = sizeof(header) + descriptors.size() * sizeof(descriptors[0]);
+  for (size_t i = 0; i < descriptors.size(); ++i) {
+    offset = alignUp(offset);
+    descriptors[i].offset = offset;
+    offset += payloads[i].iov_len;
+  }
+
+  std::vector<iovec> buffers;
+  buffers.push_back({&header, sizeof(header)});
+  buffers.push_back(
+      {descriptors.data(), descriptors.size() * sizeof(descriptors[0])});
+  size_t written = sizeof(header) + buffers.back().iov_len;
+  for (size_t i = 0; i < descriptors.size(); ++i) {
+    const size_t gap = descriptors[i].offset - written;
+    if (gap > 0) {
+      buffers.push_back({padding.data(), gap});
+    }
+    buffers.push_back(payloads[i]);
+    written = descriptors[i].offset + payloads[i].iov_len;
+  }
+
+  const std::string temporary = path + ".tmp";
+  const int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw systemError("Cannot create checkpoint " + temporary);
+  }
+  try {
+    writeAll(fd, buffers);
+    // the rename must not reach the disk before the data it points at
+    if (fsync(fd) != 0) {
+      throw systemError("Cannot sync checkpoint " + temporary);
+    }
+  } catch (...) {
+    close(fd);
+    unlink(temporary.c_str());
+    throw;
+  }
+  if (close(fd) != 0) {
+    const std::runtime_error error =
+        systemError("Cannot close checkpoint " + temporary);
+    unlink(temporary.c_str());
+    throw error;
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    const std::runtime_error error =
+        systemError("Cannot move checkpoint into place at " + path);
+    unlink(temporary.c_str());
+    throw error;
+  }
+}
+
+CheckpointView::CheckpointView(const std::string& path) : source(path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw systemError("Cannot open checkpoint " + path);
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw systemError("Cannot stat checkpoint " + path);
+  }
+  length = static_cast<size_t>(info.st_size);
+  if (length < sizeof(CheckpointHeader)) {
+    close(fd);
+    throw std::runtime_error("Checkpoint too short: " + path);
+  }
+
+  data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    data = nullptr;
+    throw systemError("Cannot map checkpoint " + path);
+  }
+  const CheckpointHeader& head = header();
+  const size_t tableEnd =
+      sizeof(CheckpointHeader) + head.fieldCount * sizeof(CheckpointField);
+  bool valid = head.magic == CHECKPOINT_MAGIC &&
+               head.version == CHECKPOINT_VERSION && tableEnd <= length;
+  for (size_t i = 0; valid && i < head.fieldCount; ++i) {
+    const CheckpointField& entry = field(i);
+    // divide rather than multiply, so a huge count cannot wrap around
+    valid = entry.offset % CHECKPOINT_ALIGNMENT == 0 &&
+            entry.offset >= tableEnd && entry.offset <= length &&
+            entry.elementSize != 0 &&
+            entry.elementCount <=
+                (length - entry.offset) / entry.elementSize &&
+            entry.name.back() == '\0';
+  }
+  if (!valid) {
+    munmap(data, length);
+    data = nullptr;
+    throw std::runtime_error("Not a valid checkpoint: " + path);
+  }
+}
+
+CheckpointView::~CheckpointView() {
+  if (data != nullptr) munmap(data, length);
+}
+
+const CheckpointHeader& CheckpointView::header() const {
+  return *static_cast<const CheckpointHeader*>(data);
+}
+
+Grid3D CheckpointView::grid() const {
+  const CheckpointHeader& head = header();
+  return {head.nx, head.ny, head.nz, static_cast<GridLayout>(head.layout)};
+}
+
+const CheckpointField& CheckpointView::field(size_t index) const {
+  const auto* table = reinterpret_cast<const CheckpointField*>(
+      static_cast<const char*>(data) + sizeof(CheckpointHeader));
+  return table[index];
+}
+
+const CheckpointField* CheckpointView::find(const std::string& name) const {
+  for (size_t i = 0; i < fieldCount(); ++i) {
+    if (name == field(i).name.data()) return &field(i);
+  }
+  return nullptr;
+}
+
+const void* CheckpointView::payload(const CheckpointField& entry) const {
+  return static_cast<const char*>(data) + entry.offset;
+}
+
+void restoreCheckpoint(const CheckpointView& view, const Grid3D& grid,
+                       Liquid& fluid) {
+  const CheckpointHeader& head = view.header();
+  if (head.nx != grid.nx || head.ny != grid.ny || head.nz != grid.nz ||
+      head.layout != static_cast<uint8_t>(grid.layout)) {
+    throw std::runtime_error("Checkpoint was saved on a different grid");
+  }
+
+  fluid.viscosity = head.viscosity;
+  fluid.diffusionRate = head.diffusionRate;
+  if (head.velocityLayout ==
+      static_cast<uint8_t>(VelocityLayout::Staggered)) {
+    enableStaggeredVelocity(grid, fluid);
+  }
+  if (head.densityRefinement > 1 &&
+      fluid.densityRefinement != head.densityRefinement) {
+    enableRefinedDensity(grid, fluid, head.densityRefinement);
+  }
+  // any other cell-sized scalar was a passive scalar
+  for (size_t i = 0; i < view.fieldCount(); ++i) {
+    const CheckpointField& entry = view.field(i);
+    const std::string name = entry.name.data();
+    if (!fluid.fields.isAllocated(name) && entry.elementSize == sizeof(float) &&
+        entry.elementCount == grid.size()) {
+      fluid.addPassiveScalar(name);
+    }
+  }
+
+  fluid.fields.forEachField([&](const std::string& name,
+                                FieldLifetime lifetime, auto& field) {
+    if (lifetime != FieldLifetime::Persistent) return;
+    const CheckpointField* entry = view.find(name);
+    if (entry == nullptr) {
+      throw std::runtime_error("Checkpoint has no field " + name);
+    }
+    if (entry->elementSize != sizeof(field[0]) ||
+        entry->elementCount != field.size()) {
+      throw std::runtime_error("Checkpoint field has a different shape: " +
+                               name);
+    }
+    // map the payload copy-on-write in place of the field's memory; pages
+    // come from the file as the solver first touches them. Adopted fields
+    // are never streamed, since evicting a private mapping drops its writes
+    auto storage = std::make_shared<FieldStorage>();
+    if (const auto current = field.get_allocator().getStorage()) {
+      *storage = *current;
+    }
+    storage->directory.clear();
+    storage->file = view.path();
+    storage->fileOffset = entry->offset;
+    storage->fileBytes = field.size() * sizeof(field[0]);
+
+    using FieldType = std::decay_t<decltype(field)>;
+    FieldType adopted{typename FieldType::allocator_type(storage)};
+    adopted.resize(field.size());
+    field.swap(adopted);
+    fluid.fields.markWritten(name);
+  });
+}
@@ -0,0 +1,233 @@
+#include "compression.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// control bytes below RUN_FLAG start 1..128 literals, the rest a run of
+// MIN_RUN..MAX_RUN copies of one byte
+constexpr uint8_t RUN_FLAG = 0x80;
+constexpr size_t MAX_LITERALS = 128;
+constexpr size_t MIN_RUN = 3;
+constexpr size_t MAX_RUN = MIN_RUN + 127;
+
+enum class FloatMode : uint8_t { Lossless = 0, Quantised = 1 };
+
+// quantised values stay below this so stride deltas fit in 32 bits, and
+// lifting in the block codec cannot overflow
+constexpr double MAX_QUANTISED = 1 << 30;
+
+// half the gap from value, as a float, to the next float up
+double halfSpacing(double value) {
+  const auto rounded = static_cast<float>(value);
+  return 0.5 * (static_cast<double>(std::nextafter(rounded, HUGE_VALF)) -
+                static_cast<double>(rounded));
+}
+
+size_t runLength(const std::vector<uint8_t>& bytes, size_t start) {
+  size_t length = 1;
+  while (start + length < bytes.size() && length < MAX_RUN &&
+         bytes[start + length] == bytes[start]) {
+    ++length;
+  }
+  return length;
+}
+
+std::vector<uint8_t> runLengthEncode(const std::vector<uint8_t>& bytes) {
+  std::vector<uint8_t> out;
+  out.reserve(bytes.size() / 4 + 16);
+
+  size_t literalStart = 0;
+  const auto flushLiterals = [&](size_t end) {
+    while (literalStart < end) {
+      const size_t count = std::min(end - literalStart, MAX_LITERALS);
+      out.push_back(static_cast<uint8_t>(count - 1));
+      const auto first = bytes.begin() + static_cast<ptrdiff_t>(literalStart);
+      out.insert(out.end(), first, first + static_cast<ptrdiff_t>(count));
+      literalStart += count;
+    }
+  };
+
+  size_t i = 0;
+  while (i < bytes.size()) {
+    const size_t run = runLength(bytes, i);
+    if (run >= MIN_RUN) {
+      flushLiterals(i);
+      out.push_back(static_cast<uint8_t>(RUN_FLAG | (run - MIN_RUN)));
+      out.push_back(bytes[i]);
+      i += run;
+      literalStart = i;
+    } else {
+      i += run;
+    }
+  }
+  flushLiterals(bytes.size());
+  return out;
+}
+
+void runLengthDecode(const uint8_t* in, size_t inSize,
+                     std::vector<uint8_t>& bytes) {
+  size_t pos = 0;
+  size_t outPos = 0;
+  while (pos < inSize) {
+    const uint8_t control = in[pos++];
+    if ((control & RUN_FLAG) != 0) {
+      const size_t run = size_t{control} - RUN_FLAG + MIN_RUN;
+      if (pos >= inSize || outPos + run > bytes.size()) {
+        throw std::runtime_error("Corrupt run in compressed data");
+      }
+      std::memset(bytes.data() + outPos, in[pos++], run);
+      outPos += run;
+    } else {
+      const size_t count = size_t{control} + 1;
+      if (pos + count > inSize || outPos + count > bytes.size()) {
+        throw std::runtime_error("Corrupt literal in compressed data");
+      }
+      std::memcpy(bytes.data() + outPos, in + pos, count);
+      pos += count;
+      outPos += count;
+    }
+  }
+  if (outPos != bytes.size()) {
+    throw std::runtime_error("Compressed data is truncated");
+  }
+}
+
+uint32_t zigzag(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1U) ^
+         static_cast<uint32_t>(value >> 31);
+}
+
+int32_t unzigzag(uint32_t value) {
+  return static_cast<int32_t>(value >> 1U) ^ -static_cast<int32_t>(value & 1U);
+}
+
+}  // namespace
+
+std::vector<uint8_t> encodeBytes(const void* data, size_t size,
+                                 size_t elementSize) {
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  const size_t elements = size / elementSize;
+
+  // byte b of every element goes to plane b; any tail stays in order
+  std::vector<uint8_t> shuffled(size);
+  for (size_t b = 0; b < elementSize; ++b) {
+    uint8_t* plane = shuffled.data() + b * elements;
+    for (size_t i = 0; i < elements; ++i) {
+      plane[i] = bytes[i * elementSize + b];
+    }
+  }
+  std::memcpy(shuffled.data() + elements * elementSize,
+              bytes + elements * elementSize, size - elements * elementSize);
+
+  return runLengthEncode(shuffled);
+}
+
+void decodeBytes(const std::vector<uint8_t>& encoded, void* data, size_t size,
+                 size_t elementSize) {
+  std::vector<uint8_t> shuffled(size);
+  runLengthDecode(encoded.data(), encoded.size(), shuffled);
+
+  auto* bytes = static_cast<uint8_t*>(data);
+  const size_t elements = size / elementSize;
+  for (size_t b = 0; b < elementSize; ++b) {
+    const uint8_t* plane = shuffled.data() + b * elements;
+    for (size_t i = 0; i < elements; ++i) {
+      bytes[i * elementSize + b] = plane[i];
+    }
+  }
+  std::memcpy(bytes + elements * elementSize,
+              shuffled.data() + elements * elementSize,
+              size - elements * elementSize);
+}
+
+double quantiserBinWidth(double largest, float tolerance, float base) {
+  if (!(tolerance > 0.0F)) return 0.0;
+  const double top = largest + static_cast<double>(tolerance);
+  double slack = halfSpacing(top);
+  if (base > 0.0F) {
+    slack += halfSpacing(top) + halfSpacing(static_cast<double>(base) + top);
+  }
+  const double width = 2.0 * (static_cast<double>(tolerance) - slack);
+  // NaN when a magnitude is not finite
+  if (!(width > 0.0) || largest / width >= MAX_QUANTISED) return 0.0;
+  return width;
+}
+
+std::vector<uint8_t> encodeFloats(const float* data, size_t count,
+                                  size_t stride, float tolerance) {
+  // a value that is not finite leaves no usable bin width
+  double largest = 0.0;
+  for (size_t i = 0; i < count && std::isfinite(largest); ++i) {
+    largest = std::isfinite(data[i])
+                  ? std::max(largest, std::fabs(static_cast<double>(data[i])))
+                  : HUGE_VAL;
+  }
+  const double binWidth =
+      count > 0 ? quantiserBinWidth(largest, tolerance) : 0.0;
+
+  std::vector<uint8_t> out;
+  if (binWidth <= 0.0) {
+    out = encodeBytes(data, count * sizeof(float), sizeof(float));
+    out.insert(out.begin(), static_cast<uint8_t>(FloatMode::Lossless));
+    return out;
+  }
+
+  const double scale = 1.0 / binWidth;
+  std::vector<int32_t> quantised(count);
+  std::vector<uint32_t> deltas(count);
+  for (size_t i = 0; i < count; ++i) {
+    quantised[i] = static_cast<int32_t>(
+        std::round(static_cast<double>(data[i]) * scale));
+    const int32_t previous = i >= stride ? quantised[i - stride] : 0;
+    deltas[i] = zigzag(quantised[i] - previous);
+  }
+
+  // the mode, then the bin width the decoder multiplies back by
+  out = encodeBytes(deltas.data(), count * sizeof(uint32_t),
+                    sizeof(uint32_t));
+  std::array<uint8_t, 1 + sizeof(double)> lead{};
+  lead[0] = static_cast<uint8_t>(FloatMode::Quantised);
+  std::memcpy(lead.data() + 1, &binWidth, sizeof(double));
+  out.insert(out.begin(), lead.begin(), lead.end());
+  return out;
+}
+
+void decodeFloats(const std::vector<uint8_t>& encoded, float* data,
+                  size_t count, size_t stride) {
+  if (encoded.empty()) {
+    throw std::runtime_error("Compressed field is empty");
+  }
+
+  if (encoded.front() == static_cast<uint8_t>(FloatMode::Lossless)) {
+    const std::vector<uint8_t> payload(encoded.begin() + 1, encoded.end());
+    decodeBytes(payload, data, count * sizeof(float), sizeof(float));
+    return;
+  }
+
+  constexpr size_t LEAD_BYTES = 1 + sizeof(double);
+  if (encoded.size() < LEAD_BYTES) {
+    throw std::runtime_error("Compressed field is truncated");
+  }
+  double binWidth = 0.0;
+  std::memcpy(&binWidth, encoded.data() + 1, sizeof(double));
+  const std::vector<uint8_t> payload(
+      encoded.begin() + static_cast<ptrdiff_t>(LEAD_BYTES), encoded.end());
+  std::vector<uint32_t> deltas(count);
+  decodeBytes(payload, deltas.data(), count * sizeof(uint32_t),
+              sizeof(uint32_t));
+
+  std::vector<int32_t> quantised(count);
+  for (size_t i = 0; i < count; ++i) {
+    const int32_t previous = i >= stride ? quantised[i - stride] : 0;
+    quantised[i] = previous + unzigzag(deltas[i]);
+    data[i] = static_cast<float>(quantised[i] * binWidth);
+  }
+}
@@ -0,0 +1,21 @@
+#include "cubic_sampler.hpp"
+
+#include <array>
+#include <cstddef>
+
+const std::array<CubicTaps, CUBIC_TABLE_STEPS + 1> CUBIC_WEIGHT_TABLE = [] {
+  constexpr float HALF = 0.5F;
+
+  std::array<CubicTaps, CUBIC_TABLE_STEPS + 1> table{};
+  for (size_t step = 0; step <= CUBIC_TABLE_STEPS; ++step) {
+    const float t =
+        static_cast<float>(step) / static_cast<float>(CUBIC_TABLE_STEPS);
+    const float t2 = t * t;
+    const float t3 = t2 * t;
+    table[step] = {HALF * (-t3 + 2.0F * t2 - t),
+                   HALF * (3.0F * t3 - 5.0F * t2 + 2.0F),
+                   HALF * (-3.0F * t3 + 4.0F * t2 + t),
+                   HALF * (t3 - t2)};
+  }
+  return table;
+}();
@@ -0,0 +1,122 @@
+#include "field.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+size_t pageSize() {
+  static const auto size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+// mmap cannot map zero bytes, so every mapping spans at least one page
+size_t mappedLength(size_t bytes) {
+  const size_t page = pageSize();
+  return bytes == 0 ? page : (bytes + page - 1) / page * page;
+}
+
+std::runtime_error systemError(const std::string& what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+}  // namespace
+
+void* mapFieldMemory(const FieldStorage& storage, size_t bytes) {
+  std::string pattern = storage.directory + "/fluidsim-field-XXXXXX";
+  std::vector<char> path(pattern.begin(), pattern.end());
+  path.push_back('\0');
+
+  const int fd = mkstemp(path.data());
+  if (fd < 0) {
+    throw systemError("Cannot create field file in " + storage.directory);
+  }
+  // the mapping keeps the file alive, so nothing is left behind on exit
+  unlink(path.data());
+
+  const size_t length = mappedLength(bytes);
+  if (ftruncate(fd, static_cast<off_t>(length)) != 0) {
+    close(fd);
+    throw systemError("Cannot size field file");
+  }
+
+  void* data =
+      mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw systemError("Cannot map field file");
+  }
+  return data;
+}
+
+void unmapFieldMemory(void* data, size_t bytes) {
+  munmap(data, mappedLength(bytes));
+}
+
+void* mapFieldFile(const FieldStorage& storage) {
+  const int fd = open(storage.file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw systemError("Cannot open " + storage.file);
+  }
+  // touching a page past the end of the file would raise SIGBUS
+  struct stat info {};
+  if (fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < storage.fileOffset ||
+      static_cast<size_t>(info.st_size) - storage.fileOffset <
+          storage.fileBytes) {
+    close(fd);
+    throw std::runtime_error("File too short to map field: " + storage.file);
+  }
+
+  // mmap offsets must be page aligned, so map from the page below
+  const size_t delta = storage.fileOffset % pageSize();
+  const size_t length = mappedLength(delta + storage.fileBytes);
+  void* data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                    static_cast<off_t>(storage.fileOffset - delta));
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw systemError("Cannot map " + storage.file);
+  }
+  return static_cast<char*>(data) + delta;
+}
+
+void unmapFieldFile(void* data, const FieldStorage& storage) {
+  const size_t delta = storage.fileOffset % pageSize();
+  munmap(static_cast<char*>(data) - delta,
+         mappedLength(delta + storage.fileBytes));
+}
+
+void adviseFieldPages(const void* data, size_t beginByte, size_t endByte,
+                      PageAdvice advice) {
+  const size_t page = pageSize();
+  const auto base = reinterpret_cast<uintptr_t>(data);
+
+  // widen prefetches to whole pages, but only evict pages entirely inside
+  // the range so neighbouring slabs keep their data resident
+  uintptr_t first = base + beginByte;
+  uintptr_t last = base + endByte;
+  if (advice == PageAdvice::Prefetch) {
+    first = first / page * page;
+    last = (last + page - 1) / page * page;
+  } else {
+    first = (first + page - 1) / page * page;
+    last = last / page * page;
+  }
+  if (first >= last) return;
+
+  // dropping a shared file mapping keeps dirty pages in the page cache for
+  // writeback, so evicting never loses data
+  const int flag =
+      advice == PageAdvice::Prefetch ? MADV_WILLNEED : MADV_DONTNEED;
+  // NOLINTNEXTLINE(performance-no-int-to-ptr)
+  madvise(reinterpret_cast<void*>(first), last - first, flag);
+}
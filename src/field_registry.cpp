@@ -0,0 +1,157 @@
+#include "field_registry.hpp"
+
+#include "field.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+template <typename T>
+size_t elementSize(const Field<T>& /*field*/) {
+  return sizeof(T);
+}
+
+template <typename T>
+size_t allocatedBytes(const Field<T>& field) {
+  return field.capacity() * sizeof(T);
+}
+
+// shared by every registry, so stamps from different fluids never match
+std::atomic<uint64_t> lastWriteStamp{0};
+
+}  // namespace
+
+FieldRegistry::Entry& FieldRegistry::find(const std::string& name) {
+  auto it = entries.find(name);
+  if (it == entries.end()) {
+    throw std::runtime_error("Unknown field: " + name);
+  }
+  return it->second;
+}
+
+const FieldRegistry::Entry& FieldRegistry::find(const std::string& name) const {
+  auto it = entries.find(name);
+  if (it == entries.end()) {
+    throw std::runtime_error("Unknown field: " + name);
+  }
+  return it->second;
+}
+
+void FieldRegistry::markWritten(const std::string& name, size_t first,
+                                size_t last) {
+  Entry& entry = find(name);
+  last = std::min(last, entry.count);
+  if (first >= last) return;
+  const uint64_t stamp =
+      lastWriteStamp.fetch_add(1, std::memory_order_relaxed) + 1;
+  const size_t firstTile = first >> FIELD_TILE_SHIFT;
+  const size_t lastTile = ((last - 1) >> FIELD_TILE_SHIFT) + 1;
+  std::fill(entry.stamps.begin() + static_cast<std::ptrdiff_t>(firstTile),
+            entry.stamps.begin() + static_cast<std::ptrdiff_t>(lastTile),
+            stamp);
+}
+
+const std::vector<uint64_t>& FieldRegistry::writeStamps(
+    const std::string& name) const {
+  return find(name).stamps;
+}
+
+void FieldRegistry::release(const std::string& name) {
+  Entry& entry = find(name);
+  if (entry.lifetime != FieldLifetime::Lazy) {
+    throw std::runtime_error("Cannot release persistent field: " + name);
+  }
+  std::visit(
+      [](auto& field) {
+        std::decay_t<decltype(field)> empty(field.get_allocator());
+        field.swap(empty);
+      },
+      entry.data);
+}
+
+bool FieldRegistry::isAllocated(const std::string& name) const {
+  auto it = entries.find(name);
+  if (it == entries.end()) return false;
+  return std::visit([](const auto& field) { return field.capacity() > 0; },
+                    it->second.data);
+}
+
+MemoryReport FieldRegistry::report() const {
+  MemoryReport result;
+  for (const auto& [name, entry] : entries) {
+    const size_t size = std::visit(
+        [](const auto& field) { return elementSize(field); }, entry.data);
+    const size_t bytes = std::visit(
+        [](const auto& field) { return allocatedBytes(field); }, entry.data);
+
+    result.fields.push_back({name, size, entry.count, bytes, entry.lifetime});
+    result.allocatedBytes += bytes;
+    result.peakBytes += std::max(bytes, size * entry.count);
+  }
+  return result;
+}
+
+size_t FieldRegistry::bytesPerElement() const {
+  // fields on other grids (faces, refined density) hold more or fewer
+  // elements than the registry's grid, so total their bytes first
+  size_t total = 0;
+  for (const auto& entry : entries) {
+    total += entry.second.count *
+             std::visit([](const auto& field) { return elementSize(field); },
+                        entry.second.data);
+  }
+  if (elements == 0) return total;
+  return (total + elements - 1) / elements;
+}
+
+void printMemoryReport(std::ostream& out, const MemoryReport& report) {
+  constexpr double BYTES_PER_MIB = 1024.0 * 1024.0;
+
+  for (const FieldUsage& field : report.fields) {
+    out << field.name << ": " << field.allocatedBytes << " bytes ("
+        << field.elementCount << " x " << field.elementSize << ")"
+        << (field.lifetime == FieldLifetime::Lazy ? " lazy" : "") << "\n";
+  }
+  out << "allocated: " << static_cast<double>(report.allocatedBytes) /
+                              BYTES_PER_MIB
+      << " MiB, peak: "
+      << static_cast<double>(report.peakBytes) / BYTES_PER_MIB << " MiB\n";
+}
+
+Grid3D fitGridToMemory(size_t memoryCap, size_t bytesPerElement, size_t nx,
+                       size_t ny, size_t nz, GridLayout layout) {
+  constexpr double SHRINK_FACTOR = 0.99;
+
+  const auto fits = [&](const Grid3D& grid) {
+    return grid.size() * bytesPerElement <= memoryCap;
+  };
+  const auto scaled = [&](double scale) {
+    const auto axis = [scale](size_t n) {
+      return std::max<size_t>(
+          1, static_cast<size_t>(static_cast<double>(n) * scale));
+    };
+    return Grid3D(axis(nx), axis(ny), axis(nz), layout);
+  };
+
+  // start from the exact cube-root scale, then back off for layout padding
+  const double cells = static_cast<double>(nx * ny * nz);
+  double scale = std::cbrt(static_cast<double>(memoryCap) /
+                           (static_cast<double>(bytesPerElement) * cells));
+  Grid3D grid = scaled(scale);
+  while (!fits(grid)) {
+    if (grid.cellCount() == 1) {
+      throw std::runtime_error("Memory cap is too small for a single cell");
+    }
+    scale *= SHRINK_FACTOR;
+    grid = scaled(scale);
+  }
+  return grid;
+}
@@ -0,0 +1,223 @@
+#include "flip.hpp"
+
+#include "advection.hpp"
+#include "field_registry.hpp"
+#include "liquid.hpp"
+#include "navier.hpp"
+#include "parallel.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// particles splat onto their base plane and the one above, so slabs two
+// planes deep that are two slabs apart never write the same plane
+constexpr size_t SPLAT_SLAB_DEPTH = 2;
+constexpr size_t SPLAT_COLOURS = 2;
+
+int baseCell(float coordinate, size_t extent) {
+  return std::clamp(static_cast<int>(std::floor(coordinate)), 0,
+                    static_cast<int>(extent) - 1);
+}
+
+}  // namespace
+
+void ParticleStore::add(const Vec3& pos, const Vec3& vel) {
+  px.push_back(pos.x);
+  py.push_back(pos.y);
+  pz.push_back(pos.z);
+  vx.push_back(vel.x);
+  vy.push_back(vel.y);
+  vz.push_back(vel.z);
+}
+
+void ParticleStore::resize(size_t count) {
+  for (std::vector<float>* component : {&px, &py, &pz, &vx, &vy, &vz}) {
+    component->resize(count);
+  }
+}
+
+FlipSolver::FlipSolver(Liquid& fluid, const FlipSettings& flipSettings)
+    : settings(flipSettings), seedCounter(flipSettings.seed) {
+  fluid.fields.add<float>(FIELD_FLIP_WEIGHT, FieldLifetime::Lazy);
+  fluid.fields.add<Vec3>(FIELD_FLIP_PREVIOUS, FieldLifetime::Lazy);
+}
+
+void FlipSolver::seedBox(const Grid3D& grid, const Vec3& lower,
+                         const Vec3& upper, const Vec3& velocity) {
+  constexpr float HALF_CELL = 0.5F;
+
+  std::mt19937 gen(seedCounter++);
+  std::uniform_real_distribution<float> jitter(-HALF_CELL, HALF_CELL);
+
+  const auto clampAxis = [](float value, size_t extent) {
+    return static_cast<size_t>(
+        std::clamp(value, 0.0F, static_cast<float>(extent)));
+  };
+  for (size_t z = clampAxis(lower.z, grid.nz);
+       z < clampAxis(upper.z, grid.nz); ++z) {
+    for (size_t y = clampAxis(lower.y, grid.ny);
+         y < clampAxis(upper.y, grid.ny); ++y) {
+      for (size_t x = clampAxis(lower.x, grid.nx);
+           x < clampAxis(upper.x, grid.nx); ++x) {
+        const Vec3 centre = cellPosition(x, y, z);
+        for (size_t p = 0; p < settings.particlesPerCell; ++p) {
+          store.add(centre + Vec3{jitter(gen), jitter(gen), jitter(gen)},
+                    velocity);
+        }
+      }
+    }
+  }
+}
+
+void FlipSolver::step(Grid3D& grid, Liquid& fluid, float timeStep,
+                      const Vec3& force) {
+  sortByCell(grid);
+  particlesToGrid(grid, fluid);
+  fluid.fields.markWritten(FIELD_VELOCITY);
+
+  Field<Vec3>& previous = fluid.fields.get<Vec3>(FIELD_FLIP_PREVIOUS);
+  std::copy(fluid.velocity.begin(), fluid.velocity.end(), previous.begin());
+
+  applyForces(timeStep, GRAVITY + force, fluid);
+  fluid.maxSpeed = project(grid, fluid);
+
+  gridToParticles(grid, fluid);
+  advectParticles(grid, fluid, timeStep);
+}
+
+// counting sort by base cell (linear order, z slowest), so particles that
+// splat to the same cells sit together and each z-slab is one range
+void FlipSolver::sortByCell(const Grid3D& grid) {
+  const size_t count = store.size();
+  if (grid.cellCount() > UINT32_MAX) {
+    throw std::runtime_error("Grid too large for FLIP cell keys");
+  }
+
+  cellStart.assign(grid.cellCount() + 1, 0);
+  particleCell.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    const auto x = static_cast<size_t>(baseCell(store.px[i], grid.nx));
+    const auto y = static_cast<size_t>(baseCell(store.py[i], grid.ny));
+    const auto z = static_cast<size_t>(baseCell(store.pz[i], grid.nz));
+    particleCell[i] = static_cast<uint32_t>(x + grid.nx * (y + grid.ny * z));
+    ++cellStart[particleCell[i] + 1];
+  }
+  for (size_t c = 1; c < cellStart.size(); ++c) {
+    cellStart[c] += cellStart[c - 1];
+  }
+
+  sorted.resize(count);
+  std::vector<size_t> cursor(cellStart.begin(), cellStart.end() - 1);
+  for (size_t i = 0; i < count; ++i) {
+    const size_t slot = cursor[particleCell[i]]++;
+    sorted.px[slot] = store.px[i];
+    sorted.py[slot] = store.py[i];
+    sorted.pz[slot] = store.pz[i];
+    sorted.vx[slot] = store.vx[i];
+    sorted.vy[slot] = store.vy[i];
+    sorted.vz[slot] = store.vz[i];
+  }
+  std::swap(store, sorted);
+}
+
+void FlipSolver::particlesToGrid(const Grid3D& grid, Liquid& fluid) {
+  Field<float>& weight = fluid.fields.get<float>(FIELD_FLIP_WEIGHT);
+  Field<Vec3>& velocity = fluid.velocity;
+  std::fill(weight.begin(), weight.end(), 0.0F);
+  std::fill(velocity.begin(), velocity.end(), Vec3{});
+
+  const size_t planeCells = grid.nx * grid.ny;
+  const size_t slabCount = (grid.nz + SPLAT_SLAB_DEPTH - 1) / SPLAT_SLAB_DEPTH;
+
+  const auto splatSlab = [&](size_t slab) {
+    const size_t zBegin = slab * SPLAT_SLAB_DEPTH;
+    const size_t zEnd = std::min(zBegin + SPLAT_SLAB_DEPTH, grid.nz);
+    for (size_t p = cellStart[zBegin * planeCells];
+         p < cellStart[zEnd * planeCells]; ++p) {
+      const SamplePoint s = samplePoint(store.position(p));
+      const Vec3 v = store.velocity(p);
+      for (int dz = 0; dz <= 1; ++dz) {
+        const float wz = dz == 0 ? 1.0F - s.w : s.w;
+        for (int dy = 0; dy <= 1; ++dy) {
+          const float wy = dy == 0 ? 1.0F - s.v : s.v;
+          for (int dx = 0; dx <= 1; ++dx) {
+            const float w = wz * wy * (dx == 0 ? 1.0F - s.u : s.u);
+            const size_t index = grid.idx(s.x0 + dx, s.y0 + dy, s.z0 + dz);
+            velocity[index] += v * w;
+            weight[index] += w;
+          }
+        }
+      }
+    }
+  };
+
+  // slabs of one colour write disjoint planes, so they need no atomics
+  for (size_t colour = 0; colour < SPLAT_COLOURS; ++colour) {
+    const size_t colourSlabs =
+        (slabCount + SPLAT_COLOURS - 1 - colour) / SPLAT_COLOURS;
+    parallelFor(colourSlabs, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        splatSlab(colour + i * SPLAT_COLOURS);
+      }
+    });
+  }
+
+  parallelFor(grid.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      if (weight[i] > 0.0F) velocity[i] = velocity[i] * (1.0F / weight[i]);
+    }
+  });
+}
+
+void FlipSolver::gridToParticles(const Grid3D& grid, Liquid& fluid) {
+  const Field<Vec3>& velocity = fluid.velocity;
+  const Field<Vec3>& previous = fluid.fields.get<Vec3>(FIELD_FLIP_PREVIOUS);
+  const float flipRatio = settings.flipRatio;
+
+  parallelFor(store.size(), [&](size_t begin, size_t end) {
+    for (size_t p = begin; p < end; ++p) {
+      const SamplePoint s = samplePoint(store.position(p));
+      const Vec3 picVelocity = trilinearInterpolate(grid, velocity, s);
+      const Vec3 change = picVelocity - trilinearInterpolate(grid, previous, s);
+      const Vec3 flipVelocity = store.velocity(p) + change;
+      const Vec3 blended =
+          flipVelocity * flipRatio + picVelocity * (1.0F - flipRatio);
+
+      store.vx[p] = blended.x;
+      store.vy[p] = blended.y;
+      store.vz[p] = blended.z;
+    }
+  });
+}
+
+// midpoint steps through the projected grid velocity, kept inside the
+// domain so every particle still lands on a cell
+void FlipSolver::advectParticles(const Grid3D& grid, const Liquid& fluid,
+                                 float timeStep) {
+  constexpr float HALF = 0.5F;
+  const Vec3 upper{static_cast<float>(grid.nx - 1),
+                   static_cast<float>(grid.ny - 1),
+                   static_cast<float>(grid.nz - 1)};
+
+  parallelFor(store.size(), [&](size_t begin, size_t end) {
+    for (size_t p = begin; p < end; ++p) {
+      const Vec3 pos = store.position(p);
+      const Vec3 mid =
+          pos + trilinearInterpolate(grid, fluid.velocity, pos) *
+                    (HALF * timeStep);
+      const Vec3 next =
+          pos + trilinearInterpolate(grid, fluid.velocity, mid) * timeStep;
+
+      store.px[p] = std::clamp(next.x, 0.0F, upper.x);
+      store.py[p] = std::clamp(next.y, 0.0F, upper.y);
+      store.pz[p] = std::clamp(next.z, 0.0F, upper.z);
+    }
+  });
+}
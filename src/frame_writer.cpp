@@ -0,0 +1,100 @@
+#include "frame_writer.hpp"
+
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+FrameWriter::FrameWriter(std::vector<std::unique_ptr<FrameSink>> frameSinks,
+                         FrameWriterSettings writerSettings)
+    : settings(writerSettings), sinks(std::move(frameSinks)) {
+  if (settings.queueDepth == 0) {
+    throw std::runtime_error("Frame queue depth must be at least 1");
+  }
+
+  // a thread without sinks would only drain its queue
+  const size_t threads =
+      std::min(std::max<size_t>(settings.writerThreads, 1), sinks.size());
+  for (size_t t = 0; t < threads; ++t) {
+    workers.push_back(std::make_unique<Worker>(settings.queueDepth));
+  }
+  for (size_t s = 0; s < sinks.size(); ++s) {
+    workers[s % threads]->sinks.push_back(sinks[s].get());
+  }
+  for (auto& worker : workers) {
+    Worker& self = *worker;
+    worker->thread = std::thread([this, &self] { run(self); });
+  }
+}
+
+FrameWriter::~FrameWriter() {
+  try {
+    close();
+  } catch (...) {
+    // a destructor cannot report sink errors; call close() to see them
+  }
+}
+
+bool FrameWriter::submit(std::shared_ptr<const LiquidSnapshot> frame) {
+  if (settings.policy == QueuePolicy::Drop) {
+    // decide once for every sink, so no sink gets a frame another skipped;
+    // submit is the only producer, so a queue with room keeps it until the
+    // push below
+    const bool room = std::none_of(
+        workers.begin(), workers.end(),
+        [](const auto& worker) { return worker->queue.full(); });
+    if (!room) {
+      ++dropped;
+      return false;
+    }
+  }
+
+  bool delivered = true;
+  for (auto& worker : workers) {
+    delivered = worker->queue.push(frame) && delivered;
+  }
+  if (!delivered) ++dropped;
+  return delivered;
+}
+
+void FrameWriter::close() {
+  if (closed) return;
+  closed = true;
+
+  for (auto& worker : workers) {
+    worker->queue.close();
+  }
+  for (auto& worker : workers) {
+    worker->thread.join();
+  }
+
+  const std::lock_guard<std::mutex> lock(errorMutex);
+  if (error) std::rethrow_exception(error);
+}
+
+void FrameWriter::run(Worker& worker) {
+  try {
+    while (const std::optional<Frame> frame = worker.queue.pop()) {
+      for (FrameSink* sink : worker.sinks) {
+        sink->write(**frame);
+      }
+    }
+    for (FrameSink* sink : worker.sinks) {
+      sink->finish();
+    }
+  } catch (...) {
+    {
+      const std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) error = std::current_exception();
+    }
+    // keep draining so a blocked solver is released
+    while (worker.queue.pop()) {
+    }
+  }
+}
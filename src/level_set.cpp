@@ -0,0 +1,315 @@
+#include "level_set.hpp"
+
+#include "advection.hpp"
+#include "field.hpp"
+#include "parallel.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr float FAR = std::numeric_limits<float>::max();
+
+// axis neighbour offsets, in pairs along x, y and z
+constexpr std::array<std::array<int, 3>, 6> NEIGHBOURS = {{{-1, 0, 0},
+                                                           {1, 0, 0},
+                                                           {0, -1, 0},
+                                                           {0, 1, 0},
+                                                           {0, 0, -1},
+                                                           {0, 0, 1}}};
+
+// upwind solution of |grad d| = 1 from the smallest known neighbour
+// distance along each axis, at unit spacing
+float solveEikonal(std::array<float, 3> axis) {
+  std::sort(axis.begin(), axis.end());
+  const float a = axis[0];
+  const float b = axis[1];
+  const float c = axis[2];
+
+  float d = a + 1.0F;
+  if (d > b) {
+    d = 0.5F * (a + b + std::sqrt(2.0F - (a - b) * (a - b)));
+    if (d > c) {
+      const float sum = a + b + c;
+      const float squares = a * a + b * b + c * c;
+      d = (sum + std::sqrt(sum * sum - 3.0F * (squares - 1.0F))) / 3.0F;
+    }
+  }
+  return d;
+}
+
+// moves (x, y, z) one step; false when that leaves the grid
+bool stepCell(const Grid3D& grid, const std::array<int, 3>& step, size_t& x,
+              size_t& y, size_t& z) {
+  const auto shift = [](size_t& coord, int delta, size_t extent) {
+    if (delta < 0 && coord == 0) return false;
+    coord = delta < 0 ? coord - 1 : coord + static_cast<size_t>(delta);
+    return coord < extent;
+  };
+  return shift(x, step[0], grid.nx) && shift(y, step[1], grid.ny) &&
+         shift(z, step[2], grid.nz);
+}
+
+int toInt(size_t value) { return static_cast<int>(value); }
+
+using HeapEntry = std::pair<float, size_t>;
+using MinHeap = std::priority_queue<HeapEntry, std::vector<HeapEntry>,
+                                    std::greater<HeapEntry>>;
+
+}  // namespace
+
+NarrowBandLevelSet::NarrowBandLevelSet(const Grid3D& levelGrid,
+                                       float bandWidth)
+    : grid(levelGrid),
+      band(bandWidth),
+      blocksX((levelGrid.nx + BLOCK_MASK) >> BLOCK_SHIFT),
+      blocksY((levelGrid.ny + BLOCK_MASK) >> BLOCK_SHIFT),
+      blocksZ((levelGrid.nz + BLOCK_MASK) >> BLOCK_SHIFT),
+      blockTable(blocksX * blocksY * blocksZ, OUTSIDE) {}
+
+void NarrowBandLevelSet::blockOrigin(size_t block, size_t& x, size_t& y,
+                                     size_t& z) const {
+  x = (block % blocksX) << BLOCK_SHIFT;
+  y = ((block / blocksX) % blocksY) << BLOCK_SHIFT;
+  z = (block / (blocksX * blocksY)) << BLOCK_SHIFT;
+}
+
+void NarrowBandLevelSet::cellOf(size_t index, size_t& x, size_t& y,
+                                size_t& z) const {
+  blockOrigin(active[index / BLOCK_CELLS], x, y, z);
+  const size_t local = index % BLOCK_CELLS;
+  x += local & BLOCK_MASK;
+  y += (local >> BLOCK_SHIFT) & BLOCK_MASK;
+  z += local >> (2 * BLOCK_SHIFT);
+}
+
+int64_t NarrowBandLevelSet::slotIndex(size_t x, size_t y, size_t z) const {
+  const int32_t entry = blockTable[blockOf(x, y, z)];
+  if (entry < 0) return -1;
+  return static_cast<int64_t>(static_cast<size_t>(entry) * BLOCK_CELLS +
+                              localOf(x, y, z));
+}
+
+float NarrowBandLevelSet::value(int x, int y, int z) const {
+  const auto cx = static_cast<size_t>(std::clamp(x, 0, toInt(grid.nx) - 1));
+  const auto cy = static_cast<size_t>(std::clamp(y, 0, toInt(grid.ny) - 1));
+  const auto cz = static_cast<size_t>(std::clamp(z, 0, toInt(grid.nz) - 1));
+
+  const int32_t entry = blockTable[blockOf(cx, cy, cz)];
+  if (entry == INSIDE) return -band;
+  if (entry == OUTSIDE) return band;
+  return values[static_cast<size_t>(entry) * BLOCK_CELLS +
+                localOf(cx, cy, cz)];
+}
+
+float NarrowBandLevelSet::sample(const Vec3& pos) const {
+  const SamplePoint s = samplePoint(pos);
+
+  const float c00 = linearInterpolate(value(s.x0, s.y0, s.z0),
+                                      value(s.x0 + 1, s.y0, s.z0), s.u);
+  const float c10 = linearInterpolate(value(s.x0, s.y0 + 1, s.z0),
+                                      value(s.x0 + 1, s.y0 + 1, s.z0), s.u);
+  const float c01 = linearInterpolate(value(s.x0, s.y0, s.z0 + 1),
+                                      value(s.x0 + 1, s.y0, s.z0 + 1), s.u);
+  const float c11 =
+      linearInterpolate(value(s.x0, s.y0 + 1, s.z0 + 1),
+                        value(s.x0 + 1, s.y0 + 1, s.z0 + 1), s.u);
+
+  return linearInterpolate(linearInterpolate(c00, c10, s.v),
+                           linearInterpolate(c01, c11, s.v), s.w);
+}
+
+size_t NarrowBandLevelSet::storedBytes() const {
+  return values.capacity() * sizeof(float) +
+         scratch.capacity() * sizeof(float) +
+         blockTable.capacity() * sizeof(int32_t) +
+         active.capacity() * sizeof(size_t);
+}
+
+void NarrowBandLevelSet::activate(size_t block, float fill) {
+  blockTable[block] = static_cast<int32_t>(active.size());
+  active.push_back(block);
+  values.resize(values.size() + BLOCK_CELLS, fill);
+}
+
+void NarrowBandLevelSet::advect(const Field<Vec3>& velocity,
+                                float timeStep) {
+  scratch.resize(values.size());
+
+  parallelFor(active.size(), [&](size_t begin, size_t end) {
+    for (size_t index = begin * BLOCK_CELLS; index < end * BLOCK_CELLS;
+         ++index) {
+      size_t x = 0, y = 0, z = 0;
+      cellOf(index, x, y, z);
+      if (!inGrid(x, y, z)) {
+        scratch[index] = values[index];
+        continue;
+      }
+      const Vec3 pos = cellPosition(x, y, z);
+      scratch[index] =
+          sample(pos - velocity[grid.offset(x, y, z)] * timeStep);
+    }
+  });
+  values.swap(scratch);
+}
+
+// stores every block next to one the band reaches, so the march can
+// follow an interface that has moved towards a block edge
+void NarrowBandLevelSet::dilate() {
+  const size_t stored = active.size();
+  for (size_t slot = 0; slot < stored; ++slot) {
+    const float* cells = &values[slot * BLOCK_CELLS];
+    const bool reached =
+        std::any_of(cells, cells + BLOCK_CELLS,
+                    [&](float d) { return std::fabs(d) < band; });
+    if (!reached) continue;
+
+    const size_t block = active[slot];
+    const size_t bx = block % blocksX;
+    const size_t by = (block / blocksX) % blocksY;
+    const size_t bz = block / (blocksX * blocksY);
+    for (size_t nz = bz > 0 ? bz - 1 : 0; nz <= std::min(bz + 1, blocksZ - 1);
+         ++nz) {
+      for (size_t ny = by > 0 ? by - 1 : 0;
+           ny <= std::min(by + 1, blocksY - 1); ++ny) {
+        for (size_t nx = bx > 0 ? bx - 1 : 0;
+             nx <= std::min(bx + 1, blocksX - 1); ++nx) {
+          const size_t neighbour = nx + blocksX * (ny + blocksY * nz);
+          const int32_t entry = blockTable[neighbour];
+          if (entry >= 0) continue;
+          activate(neighbour, entry == INSIDE ? -band : band);
+        }
+      }
+    }
+  }
+}
+
+void NarrowBandLevelSet::redistance() {
+  dilate();
+
+  const size_t count = values.size();
+  std::vector<float>& distance = scratch;
+  distance.assign(count, FAR);
+  std::vector<uint8_t> known(count, 0);
+  MinHeap front;
+
+  // cells next to a sign change start at their linear estimate of the
+  // distance to the crossing
+  for (size_t index = 0; index < count; ++index) {
+    size_t x = 0, y = 0, z = 0;
+    cellOf(index, x, y, z);
+    if (!inGrid(x, y, z)) continue;
+
+    const float phi = values[index];
+    float inverseSquares = 0.0F;
+    bool crossing = false;
+    for (size_t axis = 0; axis < 3; ++axis) {
+      float nearest = FAR;
+      for (size_t side = 0; side < 2; ++side) {
+        size_t nx = x, ny = y, nz = z;
+        if (!stepCell(grid, NEIGHBOURS[2 * axis + side], nx, ny, nz)) {
+          continue;
+        }
+        const float other = value(toInt(nx), toInt(ny), toInt(nz));
+        if ((phi < 0.0F) != (other < 0.0F)) {
+          nearest = std::min(nearest, phi / (phi - other));
+        }
+      }
+      if (nearest < FAR) {
+        crossing = true;
+        inverseSquares += nearest > 0.0F ? 1.0F / (nearest * nearest) : FAR;
+      }
+    }
+    if (crossing) {
+      distance[index] = 1.0F / std::sqrt(inverseSquares);
+      front.emplace(distance[index], index);
+    }
+  }
+
+  // march outwards in order of distance until the band edge
+  while (!front.empty()) {
+    const auto [d, index] = front.top();
+    front.pop();
+    if (known[index] != 0) continue;
+    known[index] = 1;
+    if (d >= band) continue;
+
+    size_t x = 0, y = 0, z = 0;
+    cellOf(index, x, y, z);
+    for (const std::array<int, 3>& step : NEIGHBOURS) {
+      size_t nx = x, ny = y, nz = z;
+      if (!stepCell(grid, step, nx, ny, nz)) continue;
+      const int64_t slot = slotIndex(nx, ny, nz);
+      if (slot < 0 || known[static_cast<size_t>(slot)] != 0) continue;
+      const auto neighbour = static_cast<size_t>(slot);
+
+      // smallest known distance on either side along each axis
+      std::array<float, 3> axis = {FAR, FAR, FAR};
+      for (size_t k = 0; k < NEIGHBOURS.size(); ++k) {
+        size_t ax = nx, ay = ny, az = nz;
+        if (!stepCell(grid, NEIGHBOURS[k], ax, ay, az)) continue;
+        const int64_t other = slotIndex(ax, ay, az);
+        if (other >= 0 && known[static_cast<size_t>(other)] != 0) {
+          axis[k / 2] =
+              std::min(axis[k / 2], distance[static_cast<size_t>(other)]);
+        }
+      }
+
+      const float candidate = solveEikonal(axis);
+      if (candidate < distance[neighbour]) {
+        distance[neighbour] = candidate;
+        front.emplace(candidate, neighbour);
+      }
+    }
+  }
+
+  for (size_t index = 0; index < count; ++index) {
+    const float d = std::min(distance[index], band);
+    values[index] = values[index] < 0.0F ? -d : d;
+  }
+  compact();
+}
+
+// drops blocks the band no longer reaches, remembering which side they
+// are on, and packs the remaining slots
+void NarrowBandLevelSet::compact() {
+  std::vector<size_t> kept;
+  std::vector<float> packed;
+  kept.reserve(active.size());
+  packed.reserve(values.size());
+
+  for (size_t slot = 0; slot < active.size(); ++slot) {
+    const size_t block = active[slot];
+    size_t x0 = 0, y0 = 0, z0 = 0;
+    blockOrigin(block, x0, y0, z0);
+
+    const float* cells = &values[slot * BLOCK_CELLS];
+    bool reached = false;
+    for (size_t local = 0; local < BLOCK_CELLS && !reached; ++local) {
+      const size_t x = x0 + (local & BLOCK_MASK);
+      const size_t y = y0 + ((local >> BLOCK_SHIFT) & BLOCK_MASK);
+      const size_t z = z0 + (local >> (2 * BLOCK_SHIFT));
+      reached = inGrid(x, y, z) && std::fabs(cells[local]) < band;
+    }
+
+    if (reached) {
+      blockTable[block] = static_cast<int32_t>(kept.size());
+      kept.push_back(block);
+      packed.insert(packed.end(), cells, cells + BLOCK_CELLS);
+    } else {
+      blockTable[block] = cells[0] < 0.0F ? INSIDE : OUTSIDE;
+    }
+  }
+  active.swap(kept);
+  values.swap(packed);
+}
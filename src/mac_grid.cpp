@@ -0,0 +1,278 @@
+#include "mac_grid.hpp"
+
+#include "advection.hpp"
+#include "field.hpp"
+#include "field_registry.hpp"
+#include "liquid.hpp"
+#include "navier.hpp"
+#include "slab_streamer.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+
+namespace {
+
+constexpr float HALF = 0.5F;
+
+template <typename T>
+size_t slabDepthOf(const Field<T>& field) {
+  return field.get_allocator().slabDepth();
+}
+
+int toInt(size_t value) { return static_cast<int>(value); }
+
+// registers the u, v, w fields and their scratch copies at face counts
+void registerFaceFields(const MacGrid& mac, FieldRegistry& fields) {
+  fields.add<float>(FIELD_FACE_U, FieldLifetime::Persistent, 0.0F,
+                    mac.uFaces.size());
+  fields.add<float>(FIELD_FACE_V, FieldLifetime::Persistent, 0.0F,
+                    mac.vFaces.size());
+  fields.add<float>(FIELD_FACE_W, FieldLifetime::Persistent, 0.0F,
+                    mac.wFaces.size());
+  fields.add<float>(FIELD_FACE_U_SCRATCH, FieldLifetime::Lazy, 0.0F,
+                    mac.uFaces.size());
+  fields.add<float>(FIELD_FACE_V_SCRATCH, FieldLifetime::Lazy, 0.0F,
+                    mac.vFaces.size());
+  fields.add<float>(FIELD_FACE_W_SCRATCH, FieldLifetime::Lazy, 0.0F,
+                    mac.wFaces.size());
+}
+
+FaceVelocity faceScratch(Liquid& fluid) {
+  return {fluid.fields.get<float>(FIELD_FACE_U_SCRATCH),
+          fluid.fields.get<float>(FIELD_FACE_V_SCRATCH),
+          fluid.fields.get<float>(FIELD_FACE_W_SCRATCH)};
+}
+
+void projectMac(MacGrid& mac, Liquid& fluid, FaceVelocity& faces) {
+  Field<float>& divergence = fluid.fields.get<float>(FIELD_DIVERGENCE);
+  Field<float>& pressureScratch =
+      fluid.fields.get<float>(FIELD_PRESSURE_SCRATCH);
+
+  computeMacDivergence(mac, faces, divergence);
+  solvePressure(mac.cells, divergence, fluid.pressure, pressureScratch,
+                fluid.pressureIterations, fluid.pressureTolerance);
+  fluid.fields.markWritten(FIELD_PRESSURE);
+  subtractMacPressureGradient(mac, fluid.pressure, faces);
+}
+
+// samples one face component at pos, given how far its face grid is
+// shifted from the cell centres
+float sampleFaces(const Grid3D& faceGrid, const Field<float>& component,
+                  const Vec3& pos, const Vec3& shift) {
+  return trilinearInterpolate(faceGrid, component, pos + shift);
+}
+
+const Vec3 U_SHIFT{HALF, 0.0F, 0.0F};
+const Vec3 V_SHIFT{0.0F, HALF, 0.0F};
+const Vec3 W_SHIFT{0.0F, 0.0F, HALF};
+
+// traces every face of one component back along the velocity
+void advectComponent(const MacGrid& mac, const FaceVelocity& faces,
+                     Grid3D& faceGrid, const Field<float>& src,
+                     const Vec3& shift, float timeStep, Field<float>& dst) {
+  SlabStreamer streamer(faceGrid, slabDepthOf(dst));
+  streamer.track(src).track(dst);
+
+  parallelForEachCell(faceGrid, streamer, [&](size_t x, size_t y, size_t z) {
+    const Vec3 pos = cellPosition(x, y, z) - shift;
+    const Vec3 back = pos - sampleMacVelocity(mac, faces, pos) * timeStep;
+    dst[faceGrid.offset(x, y, z)] = sampleFaces(faceGrid, src, back, shift);
+  });
+}
+
+}  // namespace
+
+void enableStaggeredVelocity(const Grid3D& grid, Liquid& fluid) {
+  if (fluid.velocityLayout == VelocityLayout::Staggered) return;
+
+  MacGrid mac(grid);
+  registerFaceFields(mac, fluid.fields);
+  FaceVelocity faces = faceVelocity(fluid);
+
+  // each face starts as the average of the two cells it separates
+  const Field<Vec3>& velocity = fluid.velocity;
+  for (size_t z = 0; z < grid.nz; ++z) {
+    for (size_t y = 0; y < grid.ny; ++y) {
+      for (size_t x = 0; x <= grid.nx; ++x) {
+        const int ix = toInt(x);
+        faces.u[mac.uFaces.offset(x, y, z)] =
+            HALF * (velocity[grid.idx(ix - 1, toInt(y), toInt(z))].x +
+                    velocity[grid.idx(ix, toInt(y), toInt(z))].x);
+      }
+    }
+  }
+  for (size_t z = 0; z < grid.nz; ++z) {
+    for (size_t y = 0; y <= grid.ny; ++y) {
+      for (size_t x = 0; x < grid.nx; ++x) {
+        const int iy = toInt(y);
+        faces.v[mac.vFaces.offset(x, y, z)] =
+            HALF * (velocity[grid.idx(toInt(x), iy - 1, toInt(z))].y +
+                    velocity[grid.idx(toInt(x), iy, toInt(z))].y);
+      }
+    }
+  }
+  for (size_t z = 0; z <= grid.nz; ++z) {
+    for (size_t y = 0; y < grid.ny; ++y) {
+      for (size_t x = 0; x < grid.nx; ++x) {
+        const int iz = toInt(z);
+        faces.w[mac.wFaces.offset(x, y, z)] =
+            HALF * (velocity[grid.idx(toInt(x), toInt(y), iz - 1)].z +
+                    velocity[grid.idx(toInt(x), toInt(y), iz)].z);
+      }
+    }
+  }
+  markFacesWritten(fluid);
+  fluid.velocityLayout = VelocityLayout::Staggered;
+}
+
+FaceVelocity faceVelocity(Liquid& fluid) {
+  return {fluid.fields.get<float>(FIELD_FACE_U),
+          fluid.fields.get<float>(FIELD_FACE_V),
+          fluid.fields.get<float>(FIELD_FACE_W)};
+}
+
+void markFacesWritten(Liquid& fluid) {
+  fluid.fields.markWritten(FIELD_FACE_U);
+  fluid.fields.markWritten(FIELD_FACE_V);
+  fluid.fields.markWritten(FIELD_FACE_W);
+}
+
+void addFaceImpulse(const Vec3& impulse, FaceVelocity& faces) {
+  for (float& u : faces.u) u += impulse.x;
+  for (float& v : faces.v) v += impulse.y;
+  for (float& w : faces.w) w += impulse.z;
+}
+
+void computeMacDivergence(MacGrid& mac, const FaceVelocity& faces,
+                          Field<float>& divergence) {
+  SlabStreamer streamer(mac.cells, slabDepthOf(divergence));
+  streamer.track(divergence);
+
+  parallelForEachCell(mac.cells, streamer, [&](size_t x, size_t y, size_t z) {
+    divergence[mac.cells.offset(x, y, z)] =
+        faces.u[mac.uFaces.offset(x + 1, y, z)] -
+        faces.u[mac.uFaces.offset(x, y, z)] +
+        faces.v[mac.vFaces.offset(x, y + 1, z)] -
+        faces.v[mac.vFaces.offset(x, y, z)] +
+        faces.w[mac.wFaces.offset(x, y, z + 1)] -
+        faces.w[mac.wFaces.offset(x, y, z)];
+  });
+}
+
+void subtractMacPressureGradient(MacGrid& mac, const Field<float>& pressure,
+                                 FaceVelocity& faces) {
+  const Grid3D& cells = mac.cells;
+
+  SlabStreamer uStreamer(mac.uFaces, slabDepthOf(faces.u));
+  uStreamer.track(faces.u);
+  parallelForEachCell(mac.uFaces, uStreamer,
+                      [&](size_t x, size_t y, size_t z) {
+                        float& u = faces.u[mac.uFaces.offset(x, y, z)];
+                        if (x == 0 || x == cells.nx) {
+                          u = 0.0F;
+                          return;
+                        }
+                        u -= pressure[cells.offset(x, y, z)] -
+                             pressure[cells.offset(x - 1, y, z)];
+                      });
+
+  SlabStreamer vStreamer(mac.vFaces, slabDepthOf(faces.v));
+  vStreamer.track(faces.v);
+  parallelForEachCell(mac.vFaces, vStreamer,
+                      [&](size_t x, size_t y, size_t z) {
+                        float& v = faces.v[mac.vFaces.offset(x, y, z)];
+                        if (y == 0 || y == cells.ny) {
+                          v = 0.0F;
+                          return;
+                        }
+                        v -= pressure[cells.offset(x, y, z)] -
+                             pressure[cells.offset(x, y - 1, z)];
+                      });
+
+  SlabStreamer wStreamer(mac.wFaces, slabDepthOf(faces.w));
+  wStreamer.track(faces.w);
+  parallelForEachCell(mac.wFaces, wStreamer,
+                      [&](size_t x, size_t y, size_t z) {
+                        float& w = faces.w[mac.wFaces.offset(x, y, z)];
+                        if (z == 0 || z == cells.nz) {
+                          w = 0.0F;
+                          return;
+                        }
+                        w -= pressure[cells.offset(x, y, z)] -
+                             pressure[cells.offset(x, y, z - 1)];
+                      });
+}
+
+Vec3 sampleMacVelocity(const MacGrid& mac, const FaceVelocity& faces,
+                       const Vec3& pos) {
+  return {sampleFaces(mac.uFaces, faces.u, pos, U_SHIFT),
+          sampleFaces(mac.vFaces, faces.v, pos, V_SHIFT),
+          sampleFaces(mac.wFaces, faces.w, pos, W_SHIFT)};
+}
+
+void advectMac(MacGrid& mac, const FaceVelocity& faces, float timeStep,
+               FaceVelocity& dst) {
+  advectComponent(mac, faces, mac.uFaces, faces.u, U_SHIFT, timeStep, dst.u);
+  advectComponent(mac, faces, mac.vFaces, faces.v, V_SHIFT, timeStep, dst.v);
+  advectComponent(mac, faces, mac.wFaces, faces.w, W_SHIFT, timeStep, dst.w);
+}
+
+float facesToCells(MacGrid& mac, const FaceVelocity& faces,
+                   Field<Vec3>& velocity) {
+  std::atomic<float> maxSpeedSquared{0.0F};
+
+  SlabStreamer streamer(mac.cells, slabDepthOf(velocity));
+  streamer.track(velocity);
+  parallelForEachCell(mac.cells, streamer, [&](size_t x, size_t y, size_t z) {
+    const Vec3 vel{HALF * (faces.u[mac.uFaces.offset(x, y, z)] +
+                           faces.u[mac.uFaces.offset(x + 1, y, z)]),
+                   HALF * (faces.v[mac.vFaces.offset(x, y, z)] +
+                           faces.v[mac.vFaces.offset(x, y + 1, z)]),
+                   HALF * (faces.w[mac.wFaces.offset(x, y, z)] +
+                           faces.w[mac.wFaces.offset(x, y, z + 1)])};
+    velocity[mac.cells.offset(x, y, z)] = vel;
+
+    const float speedSquared = vel.x * vel.x + vel.y * vel.y + vel.z * vel.z;
+    float seen = maxSpeedSquared.load(std::memory_order_relaxed);
+    while (speedSquared > seen &&
+           !maxSpeedSquared.compare_exchange_weak(
+               seen, speedSquared, std::memory_order_relaxed)) {
+    }
+  });
+  return std::sqrt(maxSpeedSquared.load());
+}
+
+void stepStaggeredVelocity(Grid3D& grid, Liquid& fluid, float timeStep) {
+  MacGrid mac(grid);
+  FaceVelocity faces = faceVelocity(fluid);
+  FaceVelocity scratch = faceScratch(fluid);
+
+  // 1. Apply external forces
+  addFaceImpulse(GRAVITY * timeStep, faces);
+
+  // 2. Diffuse each component on its own face grid
+  diffuse(mac.uFaces, faces.u, scratch.u, fluid.viscosity, timeStep,
+          fluid.diffusionIterations, fluid.diffusionTolerance);
+  diffuse(mac.vFaces, faces.v, scratch.v, fluid.viscosity, timeStep,
+          fluid.diffusionIterations, fluid.diffusionTolerance);
+  diffuse(mac.wFaces, faces.w, scratch.w, fluid.viscosity, timeStep,
+          fluid.diffusionIterations, fluid.diffusionTolerance);
+
+  // 3. Project
+  projectMac(mac, fluid, faces);
+
+  // 4. Advect
+  advectMac(mac, faces, timeStep, scratch);
+  faces.u.swap(scratch.u);
+  faces.v.swap(scratch.v);
+  faces.w.swap(scratch.w);
+
+  // 5. Project again and refresh the cell-centred copy
+  projectMac(mac, fluid, faces);
+  fluid.maxSpeed = facesToCells(mac, faces, fluid.velocity);
+  markFacesWritten(fluid);
+  fluid.fields.markWritten(FIELD_VELOCITY);
+}
@@ -6,57 +6,109 @@
 #include "WindowConfig.hpp"
 #include "WindowManager.hpp"
 #include "colour.hpp"
+#include "frame_writer.hpp"
 #include "navier.hpp"
-#include "vec3.hpp"
-#include <cmath>
+#include "playback.hpp"
+#include "shm_ring.hpp"
+#include "sim_config.hpp"
+#include "simulation.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <exception>
+#include <iostream>
 #include <liquid.hpp>
-#include <random>
+#include <memory>
+#include <optional>
 #include <string>
 
-constexpr size_t gridSizeX = 100;
-constexpr size_t gridSizeY = 100;
-constexpr size_t gridSizeZ = 50;
-
-constexpr float DEFAULT_DELTA_TIME = 0.02F;
+// fraction of a recording the arrow keys skip during playback
+constexpr size_t SEEK_FRACTION = 20;
+// solver steps backspace rewinds when history_steps is set
+constexpr size_t REWIND_STEPS = 50;
 
 void processInput(GLFWwindow* window);
-Vec3 getRandomXYZ();
-void stirFluid(Liquid& fluid, Grid3D& grid);
+int simulate(WindowManager& window, const SimConfig& settings);
+int play(WindowManager& window, const SimConfig& settings);
+
+// see parseCommandLine for the arguments and sim_config.hpp for the keys
+int main(int argc, char** argv) {
+  int status = 0;
+  try {
+    const SimConfig settings = parseCommandLine(argc, argv);
+    if (settings.headless) {
+      return navier(settings);
+    }
 
-int main() {
-  const WindowConfig config{1024, 768, "My Fluid Simulator"};
-  WindowManager window(config);
-  const Colour windowColour{0.2F, 0.3F, 0.3F, 1.0F};
+    const WindowConfig config{1024, 768, "My Fluid Simulator"};
+    WindowManager window(config);
+    status = settings.play.empty() ? simulate(window, settings)
+                                   : play(window, settings);
+  } catch (const std::exception& error) {
+    std::cerr << error.what() << "\n";
+    glfwTerminate();
+    return 1;
+  }
 
-  Grid3D grid(gridSizeX, gridSizeY, gridSizeZ);
-  Liquid water(gridSizeX, gridSizeY, gridSizeZ, VISCOSITY_WATER_M2_PER_S,
-               WATER_DIFFUSION_RATE);
+  glfwTerminate();
+  return status;
+}
 
-  std::vector<float> divergence(grid.size());
-  std::vector<float> pressure(grid.size());
+int simulate(WindowManager& window, const SimConfig& settings) {
+  const Colour windowColour{0.2F, 0.3F, 0.3F, 1.0F};
 
-  std::fill(water.density.begin(), water.density.end(),
-            DENSITY_WATER_KG_PER_M3);
+  Simulation run(settings);
+  Grid3D& grid = run.grid;
+  Liquid& water = run.fluid;
 
   FluidRenderer renderer(grid);
-  const float deltaTime = DEFAULT_DELTA_TIME;
+  // frames for viewers in other processes, see examples/shm_viewer.cpp
+  std::unique_ptr<ShmRingWriter> sharedFrames;
+  if (settings.sharedFrames) {
+    const std::string name = settings.sharedFramesName.empty()
+                                 ? sharedFrameRingName()
+                                 : settings.sharedFramesName;
+    sharedFrames = std::make_unique<ShmRingWriter>(name, grid);
+    std::cout << "publishing frames to " << name << "\n";
+  }
+  size_t frame = 0;
+
+  // recording runs on writer threads, fed frozen snapshots
+  SnapshotPublisher publisher;
+  const std::unique_ptr<FrameWriter> recorder = makeFrameWriter(settings);
 
   static float t = 0.0f;
-  t += deltaTime;
+  t += settings.frameTime;
 
   // for (size_t i = 0; i < water.density.size(); ++i) {
   //     water.density[i] = DENSITY_WATER_KG_PER_M3 + 0.1f *
   //     (std::sin(static_cast<float>(i) * 0.1f + t) + 1.0f);
   //   }
 
+  bool rewinding = false;
+
   // render loop
   while (!window.shouldClose()) {
-    processInput(WindowManager::getGLFWwindow());
-
-    stirFluid(water, grid);
+    GLFWwindow* handle = WindowManager::getGLFWwindow();
+    processInput(handle);
+
+    // one rewind per key press
+    const bool rewind = glfwGetKey(handle, GLFW_KEY_BACKSPACE) == GLFW_PRESS;
+    if (rewind && !rewinding) {
+      if (const std::optional<size_t> step = run.rewind(REWIND_STEPS)) {
+        std::cout << "rewound to step " << *step << "\n";
+      }
+    }
+    rewinding = rewind;
 
-    simulateStep(grid, water, divergence, pressure, deltaTime);
+    run.advanceFrame();
 
+    if (recorder) {
+      recorder->submit(publisher.publish(frame, grid, water));
+    }
+    if (sharedFrames) {
+      sharedFrames->publish(frame, water);
+    }
+    ++frame;
     renderer.updateSlice(water, grid);
 
     glClearColor(windowColour.r, windowColour.g, windowColour.b,
@@ -69,22 +121,61 @@ int main() {
     WindowManager::pollEvents();
   }
 
-  glfwTerminate();
+  if (recorder) {
+    recorder->close();
+  }
+  run.finish();
   return 0;
 }
 
-void stirFluid(Liquid& fluid, Grid3D& grid) {
-  for (size_t z = 0; z < grid.nx; ++z) {
-    for (size_t y = 0; y < grid.ny; ++y) {
-      for (size_t x = 0; x < grid.nx; ++x) {
-        const int ix = static_cast<int>(x);
-        const int iy = static_cast<int>(y);
-        const int iz = static_cast<int>(z);
+// shows a recording without simulating; home restarts it and the arrow
+// keys skip back and forth
+int play(WindowManager& window, const SimConfig& settings) {
+  const Colour windowColour{0.2F, 0.3F, 0.3F, 1.0F};
+
+  SeriesPlayback playback(settings.play);
+  Grid3D grid = playback.grid();
+  FluidRenderer renderer(grid);
+  const size_t skip = std::max<size_t>(playback.frameCount() / SEEK_FRACTION,
+                                       1);
+  SeriesFrame frame;
+  bool seeking = false;
 
-        fluid.velocity[grid.idx(ix, iy, iz)] += getRandomXYZ();
+  while (!window.shouldClose()) {
+    GLFWwindow* handle = WindowManager::getGLFWwindow();
+    processInput(handle);
+
+    // one seek per key press, not one per frame the key is held
+    const bool home = glfwGetKey(handle, GLFW_KEY_HOME) == GLFW_PRESS;
+    const bool right = glfwGetKey(handle, GLFW_KEY_RIGHT) == GLFW_PRESS;
+    const bool left = glfwGetKey(handle, GLFW_KEY_LEFT) == GLFW_PRESS;
+    if (!seeking) {
+      const size_t at = playback.position();
+      if (home) {
+        playback.seek(0);
+      } else if (right) {
+        playback.seek(at + skip);
+      } else if (left) {
+        playback.seek(at > skip ? at - skip : 0);
       }
     }
+    seeking = home || right || left;
+
+    // the last frame stays on screen once the recording ends
+    if (playback.next(frame)) {
+      renderer.updateSlice(frame.velocity.data(), grid);
+    }
+
+    glClearColor(windowColour.r, windowColour.g, windowColour.b,
+                 windowColour.a);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    renderer.draw();
+
+    window.swapBuffers();
+    WindowManager::pollEvents();
   }
+  return 0;
 }
 
 void processInput(GLFWwindow* window) {
@@ -92,11 +183,3 @@ void processInput(GLFWwindow* window) {
     glfwSetWindowShouldClose(window, 1);
   }
 }
-
-Vec3 getRandomXYZ() {
-  static std::random_device rd;
-  static std::mt19937 gen(rd());
-
-  std::uniform_real_distribution<float> distrib(-1.0F, 1.0F);
-  return {distrib(gen), distrib(gen), distrib(gen)};
-}
@@ -1,47 +1,64 @@
 #include "navier.hpp"
 
+#include "field.hpp"
+#include "field_registry.hpp"
+#include "frame_writer.hpp"
 #include "liquid.hpp"
+#include "mac_grid.hpp"
+#include "refinement.hpp"
+#include "sim_config.hpp"
+#include "simulation.hpp"
+#include "slab_streamer.hpp"
+#include "snapshot.hpp"
 #include "vec3.hpp"
 #include "vector_math.hpp"
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
-constexpr size_t gridSizeX = 100;
-constexpr size_t gridSizeY = 100;
-constexpr size_t gridSizeZ = 50;
-
 constexpr float DENSE_THRESHOLD = 0.9F;
 constexpr float HIGH_THRESHOLD = 0.7F;
 constexpr float MEDIUM_THRESHOLD = 0.5F;
 constexpr float LOW_THRESHOLD = 0.3F;
 constexpr float VERY_LOW_THRESHOLD = 0.1F;
 
-int navier() {
-  Grid3D grid(gridSizeX, gridSizeY, gridSizeZ);
-  Liquid water(gridSizeX, gridSizeY, gridSizeZ, VISCOSITY_WATER_M2_PER_S,
-               WATER_DIFFUSION_RATE);
-
-  std::vector<float> divergence(grid.size());
-  std::vector<float> pressure(grid.size());
-
-  // initialise water density
-  std::fill(water.density.begin(), water.density.end(),
-            DENSITY_WATER_KG_PER_M3);
+int navier(const SimConfig& config,
+           std::shared_ptr<const FieldStorage> storage) {
+  Simulation run(config, std::move(storage));
+  Grid3D& grid = run.grid;
+  Liquid& water = run.fluid;
 
-  const float deltaTime = 0.02F;
-  const size_t numSteps = 100;
+  SnapshotPublisher publisher;
+  const std::unique_ptr<FrameWriter> writer = makeFrameWriter(config);
 
-  for (size_t step = 0; step < numSteps; ++step) {
-    simulateStep(grid, water, divergence, pressure, deltaTime);
-    printDensitySlice(grid, water.density, gridSizeZ / 2);
+  for (size_t frame = 0; frame < config.frames; ++frame) {
+    run.advanceFrame();
+    if (writer) {
+      writer->submit(publisher.publish(frame, grid, water));
+    }
+    if (config.printSlices) {
+      printDensitySlice(grid, water.density, grid.nz / 2);
+    }
+  }
+  if (writer) {
+    writer->close();
+  }
+  run.finish();
+  printMemoryReport(std::cout, water.fields.report());
+  if (water.surface) {
+    std::cout << "surface: " << water.surface->activeBlockCount()
+              << " blocks, " << water.surface->storedBytes() << " bytes\n";
   }
 
   return 0;
 }
 
-void printDensitySlice(Grid3D& grid, const std::vector<float>& density,
+void printDensitySlice(Grid3D& grid, const Field<float>& density,
                        size_t zSlice) {
   float maxDensity = 0.0F;
   for (size_t y = 0; y < grid.ny; ++y) {
@@ -79,31 +96,106 @@ void printDensitySlice(Grid3D& grid, const std::vector<float>& density,
   std::cout << "\n";
 }
 
-void simulateStep(Grid3D& grid, Liquid& fluid, std::vector<float>& divergence,
-                  std::vector<float>& pressure, float timeStep) {
+namespace {
+
+// traces every cell along the current velocity; the forward trace is only
+// needed when a field uses the corrected scheme
+void traceVelocity(Grid3D& grid, Liquid& fluid, float timeStep,
+                   AdvectionScheme scheme) {
+  computeBacktrace(grid, fluid.velocity, timeStep,
+                   fluid.fields.get<SamplePoint>(FIELD_BACKTRACE),
+                   fluid.backtraceOrder);
+  if (scheme == AdvectionScheme::MacCormack) {
+    computeBacktrace(grid, fluid.velocity, -timeStep,
+                     fluid.fields.get<SamplePoint>(FIELD_FORWARD_TRACE),
+                     fluid.backtraceOrder);
+  }
+}
+
+template <typename T>
+void advectAlongTrace(Grid3D& grid, Liquid& fluid, Field<T>& field,
+                      AdvectionScheme scheme, const char* scratchName,
+                      const char* scratchName2) {
+  const Field<SamplePoint>& backtrace =
+      fluid.fields.get<SamplePoint>(FIELD_BACKTRACE);
+  Field<T>& scratch = fluid.fields.get<T>(scratchName);
+
+  if (scheme == AdvectionScheme::MacCormack) {
+    applyMacCormack(grid, backtrace,
+                    fluid.fields.get<SamplePoint>(FIELD_FORWARD_TRACE), field,
+                    scratch, fluid.fields.get<T>(scratchName2),
+                    fluid.interpolation);
+  } else {
+    applyBacktrace(grid, backtrace, field, scratch, fluid.interpolation);
+    field.swap(scratch);
+  }
+}
+
+// steps 1-5 on the cell-centred velocity
+void stepCollocatedVelocity(Grid3D& grid, Liquid& fluid, float timeStep) {
   // 1. Apply external forces
-  const Vec3 gravity{0, 0, -GRAVITY_FORCE_EARTH_M_PER_S2};
-  applyForces(timeStep, gravity, fluid);
+  applyForces(timeStep, GRAVITY, fluid);
 
   // 2. Diffuse velocity
-  std::vector<Vec3> tempVelocity(grid.size());
-  diffuse(grid, fluid.velocity, tempVelocity, fluid.viscosity, timeStep);
+  Field<Vec3>& tempVelocity = fluid.fields.get<Vec3>(FIELD_VECTOR_SCRATCH);
+  diffuse(grid, fluid.velocity, tempVelocity, fluid.viscosity, timeStep,
+          fluid.diffusionIterations, fluid.diffusionTolerance);
 
   // 3. Project velocity
-  project(grid, fluid, divergence, pressure);
+  project(grid, fluid);
 
   // 4. Advect velocity
-  advect(grid, fluid.velocity, fluid.velocity, timeStep);
+  traceVelocity(grid, fluid, timeStep, fluid.velocityAdvection);
+  advectAlongTrace(grid, fluid, fluid.velocity, fluid.velocityAdvection,
+                   FIELD_VECTOR_SCRATCH, FIELD_VECTOR_SCRATCH_2);
+
+  // 5. Project again; nothing later in the step changes velocity
+  fluid.maxSpeed = project(grid, fluid);
+  fluid.fields.markWritten(FIELD_VELOCITY);
+}
+
+}  // namespace
+
+void simulateStep(Grid3D& grid, Liquid& fluid, float timeStep) {
+  if (fluid.velocityLayout == VelocityLayout::Staggered) {
+    stepStaggeredVelocity(grid, fluid, timeStep);
+  } else {
+    stepCollocatedVelocity(grid, fluid, timeStep);
+  }
+  stepScalars(grid, fluid, timeStep);
+}
 
-  // 5. Project again
-  project(grid, fluid, divergence, pressure);
+void stepScalars(Grid3D& grid, Liquid& fluid, float timeStep) {
+  if (fluid.surface) {
+    fluid.surface->advect(fluid.velocity, timeStep);
+    fluid.surface->redistance();
+  }
 
-  // 6. Diffuse density
-  std::vector<float> tempDensity(grid.size());
-  diffuse(grid, fluid.density, tempDensity, fluid.diffusionRate, timeStep);
+  // refined density is diffused and advected on its own grid
+  const bool refined = fluid.densityRefinement > 1;
+  if (refined) {
+    stepRefinedDensity(grid, fluid, timeStep);
+  } else {
+    // 6. Diffuse density
+    Field<float>& tempDensity = fluid.fields.get<float>(FIELD_SCALAR_SCRATCH);
+    diffuse(grid, fluid.density, tempDensity, fluid.diffusionRate, timeStep,
+            fluid.diffusionIterations, fluid.diffusionTolerance);
+    fluid.fields.markWritten(FIELD_DENSITY);
+  }
 
-  // 7. Advect density
-  advect(grid, fluid.velocity, fluid.density, timeStep);
+  // 7. Advect density and passive scalars along one shared backtrace
+  if (refined && fluid.passiveScalars.empty()) return;
+  traceVelocity(grid, fluid, timeStep, fluid.densityAdvection);
+  if (!refined) {
+    advectAlongTrace(grid, fluid, fluid.density, fluid.densityAdvection,
+                     FIELD_SCALAR_SCRATCH, FIELD_SCALAR_SCRATCH_2);
+  }
+  for (const std::string& name : fluid.passiveScalars) {
+    advectAlongTrace(grid, fluid, fluid.fields.get<float>(name),
+                     fluid.densityAdvection, FIELD_SCALAR_SCRATCH,
+                     FIELD_SCALAR_SCRATCH_2);
+    fluid.fields.markWritten(name);
+  }
 }
 
 // apply gravity (testing)
@@ -111,97 +203,141 @@ void applyForces(float timeStep, const Vec3& force, Liquid& fluid) {
   for (auto& vel : fluid.velocity) {
     vel += force * timeStep;
   }
+  fluid.fields.markWritten(FIELD_VELOCITY);
+  // the staggered step rebuilds velocity from the faces
+  if (fluid.velocityLayout == VelocityLayout::Staggered) {
+    FaceVelocity faces = faceVelocity(fluid);
+    addFaceImpulse(force * timeStep, faces);
+    markFacesWritten(fluid);
+  }
 }
 
 // calculate projection
-void project(Grid3D& grid, Liquid& fluid, std::vector<float>& divergence,
-             std::vector<float>& pressure) {
+float project(Grid3D& grid, Liquid& fluid) {
+  Field<float>& divergence = fluid.fields.get<float>(FIELD_DIVERGENCE);
+  Field<float>& pressureScratch =
+      fluid.fields.get<float>(FIELD_PRESSURE_SCRATCH);
+
   computeDivergence(grid, fluid.velocity, divergence);
-  solvePressure(grid, divergence, pressure);
-  subtractPressureGradient(grid, pressure, fluid.velocity);
+  solvePressure(grid, divergence, fluid.pressure, pressureScratch,
+                fluid.pressureIterations, fluid.pressureTolerance);
+  fluid.fields.markWritten(FIELD_PRESSURE);
+  fluid.fields.markWritten(FIELD_VELOCITY);
+  return subtractPressureGradient(grid, fluid.pressure, fluid.velocity);
 }
 
-void computeDivergence(Grid3D& grid, const std::vector<Vec3>& velocity,
-                       std::vector<float>& divergence) {
+void computeDivergence(Grid3D& grid, const Field<Vec3>& velocity,
+                       Field<float>& divergence) {
   constexpr float DIV_FACTOR = 2.0F;
-  for (size_t z = 0; z < grid.nz; ++z) {
-    for (size_t y = 0; y < grid.ny; ++y) {
-      for (size_t x = 0; x < grid.nx; ++x) {
-        const int ix = static_cast<int>(x);
-        const int iy = static_cast<int>(y);
-        const int iz = static_cast<int>(z);
-
-        divergence[grid.idx(ix, iy, iz)] =
-            (velocity[grid.idx(ix + 1, iy, iz)].x -
-             velocity[grid.idx(ix - 1, iy, iz)].x +
-             velocity[grid.idx(ix, iy + 1, iz)].y -
-             velocity[grid.idx(ix, iy - 1, iz)].y +
-             velocity[grid.idx(ix, iy, iz + 1)].z -
-             velocity[grid.idx(ix, iy, iz - 1)].z) /
-            DIV_FACTOR;
+
+  SlabStreamer streamer(grid, velocity.get_allocator().slabDepth());
+  streamer.track(velocity).track(divergence);
+
+  withLayout(grid, [&](const auto& cells) {
+    streamer.run([&](size_t zBegin, size_t zEnd) {
+      for (size_t z = zBegin; z < zEnd; ++z) {
+        for (size_t y = 0; y < grid.ny; ++y) {
+          for (size_t x = 0; x < grid.nx; ++x) {
+            const int ix = static_cast<int>(x);
+            const int iy = static_cast<int>(y);
+            const int iz = static_cast<int>(z);
+
+            divergence[cells.idx(ix, iy, iz)] =
+                (velocity[cells.idx(ix + 1, iy, iz)].x -
+                 velocity[cells.idx(ix - 1, iy, iz)].x +
+                 velocity[cells.idx(ix, iy + 1, iz)].y -
+                 velocity[cells.idx(ix, iy - 1, iz)].y +
+                 velocity[cells.idx(ix, iy, iz + 1)].z -
+                 velocity[cells.idx(ix, iy, iz - 1)].z) /
+                DIV_FACTOR;
+          }
+        }
       }
-    }
-  }
+    });
+  });
 }
 
-void solvePressure(Grid3D& grid, std::vector<float>& divergence,
-                   std::vector<float>& pressure) {
+void solvePressure(Grid3D& grid, Field<float>& divergence,
+                   Field<float>& pressure, Field<float>& pressureScratch,
+                   size_t iterations, float tolerance) {
   constexpr float NUM_OF_NEIGHBOURS = 6.0F;
-  constexpr size_t MAX_ITERATIONS = 20;
-
-  std::vector<float> pressureTemp = pressure;
-
-  for (size_t i = 0; i < MAX_ITERATIONS; ++i) {
-    for (size_t z = 0; z < grid.nz; ++z) {
-      for (size_t y = 0; y < grid.ny; ++y) {
-        for (size_t x = 0; x < grid.nx; ++x) {
-          const int ix = static_cast<int>(x);
-          const int iy = static_cast<int>(y);
-          const int iz = static_cast<int>(z);
-
-          const size_t index = grid.idx(ix, iy, iz);
-
-          pressureTemp[index] =
-              (pressure[grid.idx(ix + 1, iy, iz)] +
-               pressure[grid.idx(ix - 1, iy, iz)] +
-               pressure[grid.idx(ix, iy + 1, iz)] +
-               pressure[grid.idx(ix, iy - 1, iz)] +
-               pressure[grid.idx(ix, iy, iz + 1)] +
-               pressure[grid.idx(ix, iy, iz - 1)] - divergence[index]) /
-              NUM_OF_NEIGHBOURS;
+
+  SlabStreamer streamer(grid, pressure.get_allocator().slabDepth());
+  streamer.track(divergence).track(pressure).track(pressureScratch);
+
+  withLayout(grid, [&](const auto& cells) {
+    for (size_t i = 0; i < iterations; ++i) {
+      float largestChange = 0.0F;
+      streamer.run([&](size_t zBegin, size_t zEnd) {
+        for (size_t z = zBegin; z < zEnd; ++z) {
+          for (size_t y = 0; y < grid.ny; ++y) {
+            for (size_t x = 0; x < grid.nx; ++x) {
+              const int ix = static_cast<int>(x);
+              const int iy = static_cast<int>(y);
+              const int iz = static_cast<int>(z);
+
+              const size_t index = cells.idx(ix, iy, iz);
+
+              pressureScratch[index] =
+                  (pressure[cells.idx(ix + 1, iy, iz)] +
+                   pressure[cells.idx(ix - 1, iy, iz)] +
+                   pressure[cells.idx(ix, iy + 1, iz)] +
+                   pressure[cells.idx(ix, iy - 1, iz)] +
+                   pressure[cells.idx(ix, iy, iz + 1)] +
+                   pressure[cells.idx(ix, iy, iz - 1)] - divergence[index]) /
+                  NUM_OF_NEIGHBOURS;
+              largestChange =
+                  std::max(largestChange,
+                           std::fabs(pressureScratch[index] - pressure[index]));
+            }
+          }
         }
-      }
+      });
+      std::swap(pressure, pressureScratch);
+      if (largestChange < tolerance) break;
     }
-    std::swap(pressure, pressureTemp);
-  }
+  });
 }
 
-void subtractPressureGradient(Grid3D& grid, std::vector<float>& pressure,
-                              std::vector<Vec3>& velocity) {
+float subtractPressureGradient(Grid3D& grid, Field<float>& pressure,
+                               Field<Vec3>& velocity) {
   constexpr float GRID_SPACING = 0.5F;
-
-  for (size_t z = 0; z < grid.nz; ++z) {
-    for (size_t y = 0; y < grid.ny; ++y) {
-      for (size_t x = 0; x < grid.nx; ++x) {
-        const int ix = static_cast<int>(x);
-        const int iy = static_cast<int>(y);
-        const int iz = static_cast<int>(z);
-
-        const size_t index = grid.idx(ix, iy, iz);
-
-        const float gradX = ((pressure[grid.idx(ix + 1, iy, iz)] -
-                              pressure[grid.idx(ix - 1, iy, iz)])) /
-                            (2 * GRID_SPACING);
-        const float gradY = ((pressure[grid.idx(ix, iy + 1, iz)] -
-                              pressure[grid.idx(ix, iy - 1, iz)])) /
-                            (2 * GRID_SPACING);
-        const float gradZ = ((pressure[grid.idx(ix, iy, iz + 1)] -
-                              pressure[grid.idx(ix, iy, iz - 1)])) /
-                            (2 * GRID_SPACING);
-
-        const Vec3 grad{gradX, gradY, gradZ};
-        velocity[index] -= grad;
+  float maxSpeedSquared = 0.0F;
+
+  SlabStreamer streamer(grid, velocity.get_allocator().slabDepth());
+  streamer.track(pressure).track(velocity);
+
+  withLayout(grid, [&](const auto& cells) {
+    streamer.run([&](size_t zBegin, size_t zEnd) {
+      for (size_t z = zBegin; z < zEnd; ++z) {
+        for (size_t y = 0; y < grid.ny; ++y) {
+          for (size_t x = 0; x < grid.nx; ++x) {
+            const int ix = static_cast<int>(x);
+            const int iy = static_cast<int>(y);
+            const int iz = static_cast<int>(z);
+
+            const size_t index = cells.idx(ix, iy, iz);
+
+            const float gradX = ((pressure[cells.idx(ix + 1, iy, iz)] -
+                                  pressure[cells.idx(ix - 1, iy, iz)])) /
+                                (2 * GRID_SPACING);
+            const float gradY = ((pressure[cells.idx(ix, iy + 1, iz)] -
+                                  pressure[cells.idx(ix, iy - 1, iz)])) /
+                                (2 * GRID_SPACING);
+            const float gradZ = ((pressure[cells.idx(ix, iy, iz + 1)] -
+                                  pressure[cells.idx(ix, iy, iz - 1)])) /
+                                (2 * GRID_SPACING);
+
+            const Vec3 grad{gradX, gradY, gradZ};
+            velocity[index] -= grad;
+
+            const Vec3& vel = velocity[index];
+            maxSpeedSquared = std::max(
+                maxSpeedSquared, vel.x * vel.x + vel.y * vel.y + vel.z * vel.z);
+          }
+        }
       }
-    }
-  }
+    });
+  });
+  return std::sqrt(maxSpeedSquared);
 }
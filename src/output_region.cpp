@@ -0,0 +1,118 @@
+#include "output_region.hpp"
+
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+size_t parseIndex(const std::string& text, const std::string& spec) {
+  size_t used = 0;
+  unsigned long long value = 0;
+  try {
+    value = std::stoull(text, &used);
+  } catch (const std::exception&) {
+    used = 0;
+  }
+  if (used == 0 || used != text.size()) {
+    throw std::runtime_error("Bad number in output region: " + spec);
+  }
+  return static_cast<size_t>(value);
+}
+
+}  // namespace
+
+OutputRegion OutputRegion::box(const std::array<size_t, 3>& from,
+                               const std::array<size_t, 3>& to,
+                               size_t stride) {
+  return {from, to, stride};
+}
+
+OutputRegion OutputRegion::plane(Axis axis, size_t index, size_t stride) {
+  OutputRegion region;
+  const auto a = static_cast<size_t>(axis);
+  region.begin[a] = index;
+  region.end[a] = index + 1;
+  region.stride = stride;
+  return region;
+}
+
+OutputRegion OutputRegion::decimated(size_t stride) {
+  OutputRegion region;
+  region.stride = stride;
+  return region;
+}
+
+OutputRegion OutputRegion::clippedTo(const Grid3D& grid) const {
+  const std::array<size_t, 3> size = {grid.nx, grid.ny, grid.nz};
+  OutputRegion clipped = *this;
+  for (size_t a = 0; a < 3; ++a) {
+    clipped.end[a] = std::min(end[a], size[a]);
+    if (clipped.begin[a] >= clipped.end[a]) {
+      throw std::runtime_error("Output region lies outside the grid");
+    }
+  }
+  if (stride == 0) {
+    throw std::runtime_error("Output region stride must be positive");
+  }
+  return clipped;
+}
+
+std::array<size_t, 3> OutputRegion::extent() const {
+  std::array<size_t, 3> cells{};
+  for (size_t a = 0; a < 3; ++a) {
+    cells[a] = (end[a] - begin[a] + stride - 1) / stride;
+  }
+  return cells;
+}
+
+size_t OutputRegion::cellCount() const {
+  const std::array<size_t, 3> cells = extent();
+  return cells[0] * cells[1] * cells[2];
+}
+
+bool OutputRegion::covers(const Grid3D& grid) const {
+  return stride == 1 && begin == std::array<size_t, 3>{0, 0, 0} &&
+         end == std::array<size_t, 3>{grid.nx, grid.ny, grid.nz};
+}
+
+OutputRegion parseOutputRegion(const std::string& text) {
+  std::string spec = text;
+  size_t stride = 1;
+  const size_t slash = spec.find('/');
+  if (slash != std::string::npos) {
+    stride = parseIndex(spec.substr(slash + 1), text);
+    spec.resize(slash);
+  }
+
+  if (spec == "all") {
+    return OutputRegion::decimated(stride);
+  }
+  if (spec.rfind("plane:", 0) == 0 && spec.size() > 8 && spec[7] == '=') {
+    const char axis = spec[6];
+    if (axis < 'x' || axis > 'z') {
+      throw std::runtime_error("Bad axis in output region: " + text);
+    }
+    return OutputRegion::plane(static_cast<Axis>(axis - 'x'),
+                               parseIndex(spec.substr(8), text), stride);
+  }
+  if (spec.rfind("box:", 0) == 0) {
+    std::array<size_t, 6> bounds{};
+    size_t start = 4;
+    for (size_t i = 0; i < bounds.size(); ++i) {
+      const size_t comma = spec.find(',', start);
+      const bool last = i + 1 == bounds.size();
+      if ((comma == std::string::npos) != last) {
+        throw std::runtime_error("Box needs six bounds: " + text);
+      }
+      bounds[i] = parseIndex(spec.substr(start, comma - start), text);
+      start = comma + 1;
+    }
+    return OutputRegion::box({bounds[0], bounds[1], bounds[2]},
+                             {bounds[3], bounds[4], bounds[5]}, stride);
+  }
+  throw std::runtime_error("Unknown output region: " + text);
+}
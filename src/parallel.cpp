@@ -0,0 +1,134 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// chunks handed out per thread, so uneven work still balances
+constexpr size_t CHUNKS_PER_THREAD = 4;
+
+thread_local bool insideParallelFor = false;
+
+class ThreadPool {
+ public:
+  ThreadPool() { resize(0); }
+  ~ThreadPool() { stop(); }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ThreadPool(ThreadPool&&) = delete;
+  ThreadPool& operator=(ThreadPool&&) = delete;
+
+  static ThreadPool& instance() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  void resize(size_t count) {
+    const std::lock_guard<std::mutex> running(runMutex);
+    stop();
+    if (count == 0) {
+      count = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    stopping = false;
+    for (size_t i = 1; i < count; ++i) {
+      workers.emplace_back([this] { workerLoop(); });
+    }
+  }
+
+  [[nodiscard]] size_t size() const { return workers.size() + 1; }
+
+  void run(size_t count, const std::function<void(size_t, size_t)>& body) {
+    if (count == 0) return;
+    std::unique_lock<std::mutex> running(runMutex, std::try_to_lock);
+    if (workers.empty() || insideParallelFor || !running.owns_lock()) {
+      body(0, count);
+      return;
+    }
+
+    {
+      const std::lock_guard<std::mutex> lock(mutex);
+      job = &body;
+      jobCount = count;
+      chunk = std::max<size_t>(1, count / (size() * CHUNKS_PER_THREAD));
+      next = 0;
+      active = workers.size();
+      ++generation;
+    }
+    wake.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return active == 0; });
+    job = nullptr;
+  }
+
+ private:
+  std::vector<std::thread> workers;
+  std::mutex runMutex;  // one loop at a time owns the workers
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(size_t, size_t)>* job = nullptr;
+  size_t jobCount = 0;
+  size_t chunk = 1;
+  std::atomic<size_t> next{0};
+  size_t active = 0;
+  uint64_t generation = 0;
+  bool stopping = false;
+
+  void work() {
+    insideParallelFor = true;
+    for (size_t begin = next.fetch_add(chunk); begin < jobCount;
+         begin = next.fetch_add(chunk)) {
+      (*job)(begin, std::min(begin + chunk, jobCount));
+    }
+    insideParallelFor = false;
+  }
+
+  void workerLoop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) return;
+      seen = generation;
+
+      lock.unlock();
+      work();
+      lock.lock();
+
+      if (--active == 0) done.notify_all();
+    }
+  }
+
+  void stop() {
+    {
+      const std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+    workers.clear();
+  }
+};
+
+}  // namespace
+
+void setThreadCount(size_t count) { ThreadPool::instance().resize(count); }
+
+size_t threadCount() { return ThreadPool::instance().size(); }
+
+void parallelFor(size_t count,
+                 const std::function<void(size_t, size_t)>& body) {
+  ThreadPool::instance().run(count, body);
+}
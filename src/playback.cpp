@@ -0,0 +1,110 @@
+#include "playback.hpp"
+
+#include "time_series.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+SeriesPlayback::SeriesPlayback(const std::string& path, size_t readAhead)
+    : reader(path), depth(std::max<size_t>(readAhead, 1)) {
+  reader.prefetch(0, 2 * depth);
+  decoder = std::thread([this] { decode(); });
+}
+
+SeriesPlayback::~SeriesPlayback() {
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  decoder.join();
+}
+
+size_t SeriesPlayback::position() const {
+  const std::lock_guard<std::mutex> lock(mutex);
+  return returned;
+}
+
+void SeriesPlayback::seek(size_t frame) {
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    frame = std::min(frame, reader.frameCount());
+    for (std::unique_ptr<SeriesFrame>& decoded : ready) {
+      spare.push_back(std::move(decoded));
+    }
+    ready.clear();
+    cursor = frame;
+    returned = frame;
+    // a frame being decoded now is from before the seek; it is discarded
+    ++generation;
+  }
+  changed.notify_all();
+}
+
+bool SeriesPlayback::next(SeriesFrame& out) {
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [this] {
+    return error || !ready.empty() ||
+           (cursor >= reader.frameCount() && !decoding);
+  });
+  if (error) {
+    std::rethrow_exception(std::exchange(error, nullptr));
+  }
+  if (ready.empty()) return false;
+
+  std::unique_ptr<SeriesFrame> decoded = std::move(ready.front());
+  ready.pop_front();
+  std::swap(out, *decoded);
+  spare.push_back(std::move(decoded));
+  ++returned;
+  changed.notify_all();
+  return true;
+}
+
+void SeriesPlayback::decode() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    changed.wait(lock, [this] {
+      return stopping ||
+             (!error && cursor < reader.frameCount() && ready.size() < depth);
+    });
+    if (stopping) return;
+
+    const size_t frame = cursor++;
+    const size_t startedIn = generation;
+    std::unique_ptr<SeriesFrame> buffer;
+    if (spare.empty()) {
+      buffer = std::make_unique<SeriesFrame>();
+    } else {
+      buffer = std::move(spare.back());
+      spare.pop_back();
+    }
+    decoding = true;
+    lock.unlock();
+
+    std::exception_ptr failure;
+    try {
+      reader.read(frame, *buffer);
+      // the queue holds the next depth frames; page in the depth after
+      reader.prefetch(frame + depth, depth);
+    } catch (...) {
+      failure = std::current_exception();
+    }
+
+    lock.lock();
+    decoding = false;
+    if (startedIn != generation) {
+      spare.push_back(std::move(buffer));
+    } else if (failure) {
+      error = failure;
+      spare.push_back(std::move(buffer));
+    } else {
+      ready.push_back(std::move(buffer));
+    }
+    changed.notify_all();
+  }
+}
@@ -0,0 +1,154 @@
+#include "refinement.hpp"
+
+#include "advection.hpp"
+#include "field.hpp"
+#include "field_registry.hpp"
+#include "liquid.hpp"
+#include "navier.hpp"
+#include "slab_streamer.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+namespace {
+
+// where the fine cell (x, y, z) traces back to, as a sample on the fine grid
+SamplePoint fineBacktrace(const Grid3D& grid, const Field<Vec3>& velocity,
+                          size_t factor, size_t x, size_t y, size_t z,
+                          float timeStep, BacktraceOrder order) {
+  const Vec3 pos = fineToCoarse(cellPosition(x, y, z), factor);
+  const Vec3 velocityAtPos = trilinearInterpolate(grid, velocity, pos);
+  const Vec3 back =
+      tracePosition(grid, velocity, pos, velocityAtPos, timeStep, order);
+  return samplePoint(coarseToFine(back, factor));
+}
+
+}  // namespace
+
+Grid3D refineGrid(const Grid3D& grid, size_t factor) {
+  return {grid.nx * factor, grid.ny * factor, grid.nz * factor, grid.layout};
+}
+
+void enableRefinedDensity(const Grid3D& grid, Liquid& fluid, size_t factor) {
+  if (factor != 2 && factor != 4) {
+    throw std::runtime_error("Density refinement must be 2 or 4");
+  }
+  if (fluid.densityRefinement != 1) {
+    throw std::runtime_error("Density is already refined");
+  }
+
+  const Grid3D fineGrid = refineGrid(grid, factor);
+  Field<float>& fine = fluid.fields.add<float>(
+      FIELD_DENSITY_FINE, FieldLifetime::Persistent, 0.0F, fineGrid.size());
+  fluid.fields.add<float>(FIELD_FINE_SCRATCH, FieldLifetime::Lazy, 0.0F,
+                          fineGrid.size());
+  fluid.fields.add<float>(FIELD_FINE_SCRATCH_2, FieldLifetime::Lazy, 0.0F,
+                          fineGrid.size());
+
+  // every fine cell starts with the value of the coarse cell it lies in
+  for (size_t z = 0; z < fineGrid.nz; ++z) {
+    for (size_t y = 0; y < fineGrid.ny; ++y) {
+      for (size_t x = 0; x < fineGrid.nx; ++x) {
+        fine[fineGrid.offset(x, y, z)] =
+            fluid.density[grid.offset(x / factor, y / factor, z / factor)];
+      }
+    }
+  }
+  fluid.fields.markWritten(FIELD_DENSITY_FINE);
+  fluid.densityRefinement = factor;
+}
+
+void advectRefined(const Grid3D& grid, const Field<Vec3>& velocity,
+                   Grid3D& fineGrid, size_t factor, const Field<float>& src,
+                   Field<float>& dst, float timeStep, BacktraceOrder order,
+                   Interpolation interpolation) {
+  SlabStreamer streamer(fineGrid, dst.get_allocator().slabDepth());
+  streamer.track(src).track(dst);
+
+  parallelForEachCell(fineGrid, streamer, [&](size_t x, size_t y, size_t z) {
+    dst[fineGrid.offset(x, y, z)] = interpolate(
+        fineGrid, src,
+        fineBacktrace(grid, velocity, factor, x, y, z, timeStep, order),
+        interpolation);
+  });
+}
+
+void macCormackRefined(const Grid3D& grid, const Field<Vec3>& velocity,
+                       Grid3D& fineGrid, size_t factor, Field<float>& field,
+                       Field<float>& forward, Field<float>& corrected,
+                       float timeStep, BacktraceOrder order,
+                       Interpolation interpolation) {
+  constexpr float HALF = 0.5F;
+
+  advectRefined(grid, velocity, fineGrid, factor, field, forward, timeStep,
+                order, interpolation);
+  advectRefined(grid, velocity, fineGrid, factor, forward, corrected,
+                -timeStep, order, interpolation);
+
+  SlabStreamer streamer(fineGrid, field.get_allocator().slabDepth());
+  streamer.track(field).track(forward).track(corrected);
+
+  parallelForEachCell(fineGrid, streamer, [&](size_t x, size_t y, size_t z) {
+    const size_t index = fineGrid.offset(x, y, z);
+    const SamplePoint back =
+        fineBacktrace(grid, velocity, factor, x, y, z, timeStep, order);
+
+    float lower = 0.0F;
+    float upper = 0.0F;
+    trilinearBounds(fineGrid, field, back, lower, upper);
+
+    const float estimate =
+        forward[index] + HALF * (field[index] - corrected[index]);
+    corrected[index] = std::clamp(estimate, lower, upper);
+  });
+
+  field.swap(corrected);
+}
+
+void restrictToCoarse(Grid3D& grid, const Grid3D& fineGrid, size_t factor,
+                      const Field<float>& fine, Field<float>& coarse) {
+  const float weight = 1.0F / static_cast<float>(factor * factor * factor);
+
+  SlabStreamer streamer(grid, coarse.get_allocator().slabDepth());
+  streamer.track(coarse);
+
+  parallelForEachCell(grid, streamer, [&](size_t x, size_t y, size_t z) {
+    float sum = 0.0F;
+    for (size_t dz = 0; dz < factor; ++dz) {
+      for (size_t dy = 0; dy < factor; ++dy) {
+        for (size_t dx = 0; dx < factor; ++dx) {
+          sum += fine[fineGrid.offset(x * factor + dx, y * factor + dy,
+                                      z * factor + dz)];
+        }
+      }
+    }
+    coarse[grid.offset(x, y, z)] = sum * weight;
+  });
+}
+
+void stepRefinedDensity(Grid3D& grid, Liquid& fluid, float timeStep) {
+  const size_t factor = fluid.densityRefinement;
+  Grid3D fineGrid = refineGrid(grid, factor);
+  Field<float>& fine = fluid.fields.get<float>(FIELD_DENSITY_FINE);
+  Field<float>& scratch = fluid.fields.get<float>(FIELD_FINE_SCRATCH);
+
+  // the rate is per coarse cell; fine cells are factor times narrower
+  const auto cellRatio = static_cast<float>(factor * factor);
+  diffuse(fineGrid, fine, scratch, fluid.diffusionRate * cellRatio,
+          timeStep, fluid.diffusionIterations, fluid.diffusionTolerance);
+
+  if (fluid.densityAdvection == AdvectionScheme::MacCormack) {
+    macCormackRefined(grid, fluid.velocity, fineGrid, factor, fine, scratch,
+                      fluid.fields.get<float>(FIELD_FINE_SCRATCH_2),
+                      timeStep, fluid.backtraceOrder, fluid.interpolation);
+  } else {
+    advectRefined(grid, fluid.velocity, fineGrid, factor, fine, scratch,
+                  timeStep, fluid.backtraceOrder, fluid.interpolation);
+    fine.swap(scratch);
+  }
+
+  restrictToCoarse(grid, fineGrid, factor, fine, fluid.density);
+  fluid.fields.markWritten(FIELD_DENSITY_FINE);
+  fluid.fields.markWritten(FIELD_DENSITY);
+}
@@ -0,0 +1,136 @@
+#include "rollback_history.hpp"
+
+#include "compression.hpp"
+#include "field_registry.hpp"
+#include "liquid.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+RollbackHistory::RollbackHistory(const HistoryConfig& historyConfig)
+    : config(historyConfig),
+      pending(PENDING_SNAPSHOTS),
+      worker([this] { compressLoop(); }) {}
+
+RollbackHistory::~RollbackHistory() {
+  pending.close();
+  worker.join();
+}
+
+void RollbackHistory::record(size_t step, const Liquid& fluid) {
+  Snapshot snapshot;
+  snapshot.step = step;
+
+  fluid.fields.forEachField(
+      [&](const std::string& name, FieldLifetime lifetime, const auto& field) {
+        if (lifetime != FieldLifetime::Persistent) return;
+
+        using Element = typename std::decay_t<decltype(field)>::value_type;
+        const size_t floatsPerElement = sizeof(Element) / sizeof(float);
+        FieldData data{name, floatsPerElement,
+                       field.size() * floatsPerElement, {}, {}};
+        data.raw.resize(data.floatCount);
+        std::memcpy(data.raw.data(), field.data(),
+                    data.floatCount * sizeof(float));
+        snapshot.fields.push_back(std::move(data));
+      });
+
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    ++inFlight;
+  }
+  pending.push(std::move(snapshot));
+}
+
+void RollbackHistory::compressLoop() {
+  while (auto snapshot = pending.pop()) {
+    for (FieldData& field : snapshot->fields) {
+      field.compressed =
+          encodeFloats(field.raw.data(), field.floatCount,
+                       field.floatsPerElement, config.tolerance);
+      snapshot->bytes += field.compressed.size();
+      std::vector<float>().swap(field.raw);
+    }
+
+    const std::lock_guard<std::mutex> lock(mutex);
+    totalBytes += snapshot->bytes;
+    snapshots.push_back(std::move(*snapshot));
+    evict();
+    --inFlight;
+    idle.notify_all();
+  }
+}
+
+void RollbackHistory::evict() {
+  const auto overBudget = [this] {
+    return config.maxBytes != 0 && totalBytes > config.maxBytes;
+  };
+  // the newest snapshot is always kept, even if it alone is over budget
+  while (snapshots.size() > 1 &&
+         (snapshots.size() > config.maxSnapshots || overBudget())) {
+    totalBytes -= snapshots.front().bytes;
+    snapshots.pop_front();
+  }
+}
+
+void RollbackHistory::waitForCompression(std::unique_lock<std::mutex>& lock) {
+  idle.wait(lock, [this] { return inFlight == 0; });
+}
+
+bool RollbackHistory::restore(size_t step, Liquid& fluid) {
+  std::unique_lock<std::mutex> lock(mutex);
+  waitForCompression(lock);
+
+  auto it = std::find_if(snapshots.begin(), snapshots.end(),
+                         [step](const Snapshot& s) { return s.step == step; });
+  if (it == snapshots.end()) return false;
+
+  fluid.fields.forEachField(
+      [&](const std::string& name, FieldLifetime lifetime, auto& field) {
+        if (lifetime != FieldLifetime::Persistent) return;
+
+        auto data = std::find_if(
+            it->fields.begin(), it->fields.end(),
+            [&name](const FieldData& f) { return f.name == name; });
+        if (data == it->fields.end() ||
+            data->floatCount * sizeof(float) !=
+                field.size() * sizeof(field[0])) {
+          throw std::runtime_error("Snapshot does not match field: " + name);
+        }
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        decodeFloats(data->compressed, reinterpret_cast<float*>(field.data()),
+                     data->floatCount, data->floatsPerElement);
+        fluid.fields.markWritten(name);
+      });
+
+  for (auto later = std::next(it); later != snapshots.end(); ++later) {
+    totalBytes -= later->bytes;
+  }
+  snapshots.erase(std::next(it), snapshots.end());
+  return true;
+}
+
+std::vector<size_t> RollbackHistory::steps() {
+  std::unique_lock<std::mutex> lock(mutex);
+  waitForCompression(lock);
+
+  std::vector<size_t> result;
+  result.reserve(snapshots.size());
+  for (const Snapshot& snapshot : snapshots) {
+    result.push_back(snapshot.step);
+  }
+  return result;
+}
+
+size_t RollbackHistory::compressedBytes() {
+  std::unique_lock<std::mutex> lock(mutex);
+  waitForCompression(lock);
+  return totalBytes;
+}
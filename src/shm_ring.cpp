@@ -0,0 +1,192 @@
+#include "shm_ring.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "liquid.hpp"
+#include "parallel.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+
+constexpr uint32_t RING_VERSION = 1;
+constexpr std::array<char, 8> RING_MAGIC = {'F', 'S', 'R', 'I',
+                                            'N', 'G', '0', '1'};
+constexpr size_t RING_ALIGNMENT = 64;
+// bytes each task copies when filling a slot
+constexpr size_t COPY_CHUNK = size_t{1} << 20;
+
+std::runtime_error systemError(const std::string& what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+size_t alignUp(size_t bytes) {
+  return (bytes + RING_ALIGNMENT - 1) / RING_ALIGNMENT * RING_ALIGNMENT;
+}
+
+void parallelCopy(uint8_t* dst, const void* src, size_t bytes) {
+  const auto* from = static_cast<const uint8_t*>(src);
+  parallelFor((bytes + COPY_CHUNK - 1) / COPY_CHUNK,
+              [&](size_t begin, size_t end) {
+                const size_t first = begin * COPY_CHUNK;
+                const size_t last = std::min(end * COPY_CHUNK, bytes);
+                std::memcpy(dst + first, from + first, last - first);
+              });
+}
+
+}  // namespace
+
+std::string sharedFrameRingName() {
+  return "/fluidsim-frames-" + std::to_string(getpid());
+}
+
+ShmSlotLayout shmSlotLayout(const Grid3D& grid) {
+  ShmSlotLayout layout{};
+  layout.velocity = sizeof(ShmSlot);
+  layout.density = alignUp(layout.velocity + grid.size() * sizeof(Vec3));
+  layout.pressure = alignUp(layout.density + grid.size() * sizeof(float));
+  layout.bytes = alignUp(layout.pressure + grid.size() * sizeof(float));
+  return layout;
+}
+
+ShmRingWriter::ShmRingWriter(std::string name, const Grid3D& grid,
+                             size_t slots)
+    : ringName(std::move(name)), layout(shmSlotLayout(grid)) {
+  slots = std::max<size_t>(slots, 1);
+  length = sizeof(ShmRingHeader) + slots * layout.bytes;
+
+  // never take over a name another run may still be publishing to
+  const int fd = shm_open(ringName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    throw std::runtime_error("Shared memory " + ringName +
+                             " already exists; pick another "
+                             "shared_frames_name or remove it");
+  }
+  if (fd < 0) {
+    throw systemError("Cannot create shared memory " + ringName);
+  }
+  if (ftruncate(fd, static_cast<off_t>(length)) != 0) {
+    close(fd);
+    shm_unlink(ringName.c_str());
+    throw systemError("Cannot size shared memory " + ringName);
+  }
+  mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    shm_unlink(ringName.c_str());
+    throw systemError("Cannot map shared memory " + ringName);
+  }
+
+  // the object starts zeroed, so every slot begins at sequence 0
+  auto* base = static_cast<uint8_t*>(mapping);
+  for (size_t s = 0; s < slots; ++s) {
+    new (base + sizeof(ShmRingHeader) + s * layout.bytes) ShmSlot{};
+  }
+  header = new (mapping) ShmRingHeader{};
+  header->version = RING_VERSION;
+  header->slotCount = static_cast<uint32_t>(slots);
+  header->nx = grid.nx;
+  header->ny = grid.ny;
+  header->nz = grid.nz;
+  header->slotBytes = layout.bytes;
+  header->layout = static_cast<uint8_t>(grid.layout);
+  // readers check the magic last, once the rest is in place
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = RING_MAGIC;
+}
+
+ShmRingWriter::~ShmRingWriter() {
+  munmap(mapping, length);
+  shm_unlink(ringName.c_str());
+}
+
+void ShmRingWriter::publish(uint64_t step, const Liquid& fluid) {
+  const uint64_t frame = header->published.load(std::memory_order_relaxed);
+  uint8_t* base = static_cast<uint8_t*>(mapping) + sizeof(ShmRingHeader) +
+                  (frame % header->slotCount) * layout.bytes;
+  auto* slot = std::launder(reinterpret_cast<ShmSlot*>(base));
+
+  slot->sequence.store(2 * frame + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->step = step;
+  parallelCopy(base + layout.velocity, fluid.velocity.data(),
+               fluid.velocity.size() * sizeof(Vec3));
+  parallelCopy(base + layout.density, fluid.density.data(),
+               fluid.density.size() * sizeof(float));
+  parallelCopy(base + layout.pressure, fluid.pressure.data(),
+               fluid.pressure.size() * sizeof(float));
+  slot->sequence.store(2 * (frame + 1), std::memory_order_release);
+  header->published.store(frame + 1, std::memory_order_release);
+}
+
+ShmRingReader::ShmRingReader(const std::string& name) {
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    throw systemError("Cannot open shared memory " + name);
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw systemError("Cannot stat shared memory " + name);
+  }
+  length = static_cast<size_t>(info.st_size);
+  void* mapped = length < sizeof(ShmRingHeader)
+                     ? MAP_FAILED
+                     : mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Cannot map shared memory " + name);
+  }
+  mapping = static_cast<const uint8_t*>(mapped);
+  header = std::launder(reinterpret_cast<const ShmRingHeader*>(mapping));
+
+  const std::array<char, 8> magic = header->magic;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  layout = shmSlotLayout(grid());
+  if (magic != RING_MAGIC || header->version != RING_VERSION ||
+      header->slotCount == 0 || header->slotBytes != layout.bytes ||
+      sizeof(ShmRingHeader) + header->slotCount * layout.bytes > length) {
+    munmap(mapped, length);
+    throw std::runtime_error("Not a frame ring: " + name);
+  }
+}
+
+ShmRingReader::~ShmRingReader() {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  munmap(const_cast<uint8_t*>(mapping), length);
+}
+
+Grid3D ShmRingReader::grid() const {
+  return {header->nx, header->ny, header->nz,
+          static_cast<GridLayout>(header->layout)};
+}
+
+const ShmSlot& ShmRingReader::slotAt(uint64_t frame) const {
+  const uint8_t* base = mapping + sizeof(ShmRingHeader) +
+                        (frame % header->slotCount) * layout.bytes;
+  return *std::launder(reinterpret_cast<const ShmSlot*>(base));
+}
+
+ShmFrameView ShmRingReader::viewOf(uint64_t frame) const {
+  const uint8_t* base = mapping + sizeof(ShmRingHeader) +
+                        (frame % header->slotCount) * layout.bytes;
+  return {frame, slotAt(frame).step,
+          std::launder(reinterpret_cast<const Vec3*>(base + layout.velocity)),
+          std::launder(reinterpret_cast<const float*>(base + layout.density)),
+          std::launder(
+              reinterpret_cast<const float*>(base + layout.pressure))};
+}
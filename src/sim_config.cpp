@@ -0,0 +1,465 @@
+#include "sim_config.hpp"
+
+#include "advection.hpp"
+#include "frame_writer.hpp"
+#include "level_set.hpp"
+#include "liquid.hpp"
+#include "mac_grid.hpp"
+#include "output_region.hpp"
+#include "parallel.hpp"
+#include "refinement.hpp"
+#include "time_series.hpp"
+#include "timestep.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include "vti_writer.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const std::array<std::pair<const char*, GridLayout>, 3> LAYOUTS = {{
+    {"linear", GridLayout::Linear},
+    {"tiled", GridLayout::Tiled},
+    {"morton", GridLayout::Morton},
+}};
+const std::array<std::pair<const char*, VelocitySolver>, 2> SOLVERS = {{
+    {"grid", VelocitySolver::Grid},
+    {"flip", VelocitySolver::Flip},
+}};
+const std::array<std::pair<const char*, VelocityLayout>, 2> VELOCITY_LAYOUTS =
+    {{
+        {"collocated", VelocityLayout::Collocated},
+        {"staggered", VelocityLayout::Staggered},
+    }};
+const std::array<std::pair<const char*, BacktraceOrder>, 3> BACKTRACES = {{
+    {"euler", BacktraceOrder::Euler},
+    {"midpoint", BacktraceOrder::Midpoint},
+    {"rk3", BacktraceOrder::RK3},
+}};
+const std::array<std::pair<const char*, AdvectionScheme>, 2> SCHEMES = {{
+    {"semi-lagrangian", AdvectionScheme::SemiLagrangian},
+    {"maccormack", AdvectionScheme::MacCormack},
+}};
+const std::array<std::pair<const char*, Interpolation>, 2> SAMPLERS = {{
+    {"trilinear", Interpolation::Trilinear},
+    {"cubic", Interpolation::MonotoneCubic},
+}};
+
+std::runtime_error badValue(const std::string& value) {
+  return std::runtime_error("bad value '" + value + "'");
+}
+
+template <typename T, size_t N>
+T parseChoice(const std::string& value,
+              const std::array<std::pair<const char*, T>, N>& names) {
+  for (const auto& [name, choice] : names) {
+    if (value == name) return choice;
+  }
+  std::string expected;
+  for (const auto& entry : names) {
+    expected += expected.empty() ? "" : ", ";
+    expected += entry.first;
+  }
+  throw std::runtime_error("bad value '" + value + "', expected one of " +
+                           expected);
+}
+
+size_t parseSize(const std::string& value) {
+  size_t used = 0;
+  unsigned long long parsed = 0;
+  try {
+    parsed = std::stoull(value, &used);
+  } catch (const std::exception&) {
+    throw badValue(value);
+  }
+  if (used != value.size() || value.front() == '-') throw badValue(value);
+  return static_cast<size_t>(parsed);
+}
+
+// a byte count with an optional K, M or G (binary) suffix
+size_t parseBytes(const std::string& value) {
+  constexpr std::array<std::pair<char, size_t>, 3> SUFFIXES = {{
+      {'K', size_t{1} << 10U},
+      {'M', size_t{1} << 20U},
+      {'G', size_t{1} << 30U},
+  }};
+  if (value.empty()) throw badValue(value);
+  for (const auto& [suffix, scale] : SUFFIXES) {
+    if (value.back() != suffix) continue;
+    const size_t count = parseSize(value.substr(0, value.size() - 1));
+    if (count > SIZE_MAX / scale) throw badValue(value);
+    return count * scale;
+  }
+  return parseSize(value);
+}
+
+float parseFloat(const std::string& value) {
+  size_t used = 0;
+  float parsed = 0.0F;
+  try {
+    parsed = std::stof(value, &used);
+  } catch (const std::exception&) {
+    throw badValue(value);
+  }
+  if (used != value.size()) throw badValue(value);
+  return parsed;
+}
+
+bool parseBool(const std::string& value) {
+  if (value == "true" || value == "yes" || value == "1") return true;
+  if (value == "false" || value == "no" || value == "0") return false;
+  throw badValue(value);
+}
+
+Vec3 parseVec3(const std::string& value) {
+  const size_t first = value.find(',');
+  const size_t second =
+      first == std::string::npos ? first : value.find(',', first + 1);
+  if (second == std::string::npos) throw badValue(value);
+  return {parseFloat(value.substr(0, first)),
+          parseFloat(value.substr(first + 1, second - first - 1)),
+          parseFloat(value.substr(second + 1))};
+}
+
+std::string trim(const std::string& text) {
+  const size_t begin = text.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) return {};
+  const size_t end = text.find_last_not_of(" \t\r");
+  return text.substr(begin, end - begin + 1);
+}
+
+using Setter = void (*)(SimConfig&, const std::string&);
+
+const std::array<std::pair<const char*, Setter>, 50> KEYS = {{
+    {"nx", [](SimConfig& c, const std::string& v) { c.nx = parseSize(v); }},
+    {"ny", [](SimConfig& c, const std::string& v) { c.ny = parseSize(v); }},
+    {"nz", [](SimConfig& c, const std::string& v) { c.nz = parseSize(v); }},
+    {"layout",
+     [](SimConfig& c, const std::string& v) {
+       c.layout = parseChoice(v, LAYOUTS);
+     }},
+    {"memory_limit",
+     [](SimConfig& c, const std::string& v) {
+       c.memoryLimit = parseBytes(v);
+     }},
+    {"frame_time",
+     [](SimConfig& c, const std::string& v) { c.frameTime = parseFloat(v); }},
+    {"frames",
+     [](SimConfig& c, const std::string& v) { c.frames = parseSize(v); }},
+    {"cfl",
+     [](SimConfig& c, const std::string& v) {
+       c.timestep.cflTarget = parseFloat(v);
+     }},
+    {"min_step",
+     [](SimConfig& c, const std::string& v) {
+       c.timestep.minStep = parseFloat(v);
+     }},
+    {"max_step",
+     [](SimConfig& c, const std::string& v) {
+       c.timestep.maxStep = parseFloat(v);
+     }},
+    {"viscosity",
+     [](SimConfig& c, const std::string& v) { c.viscosity = parseFloat(v); }},
+    {"diffusion_rate",
+     [](SimConfig& c, const std::string& v) {
+       c.diffusionRate = parseFloat(v);
+     }},
+    {"initial_density",
+     [](SimConfig& c, const std::string& v) {
+       c.initialDensity = parseFloat(v);
+     }},
+    {"solver",
+     [](SimConfig& c, const std::string& v) {
+       c.solver = parseChoice(v, SOLVERS);
+     }},
+    {"flip_ratio",
+     [](SimConfig& c, const std::string& v) { c.flipRatio = parseFloat(v); }},
+    {"particles_per_cell",
+     [](SimConfig& c, const std::string& v) {
+       c.particlesPerCell = parseSize(v);
+     }},
+    {"surface_height",
+     [](SimConfig& c, const std::string& v) {
+       c.surfaceHeight = parseFloat(v);
+     }},
+    {"surface_band",
+     [](SimConfig& c, const std::string& v) {
+       c.surfaceBand = parseFloat(v);
+     }},
+    {"velocity_layout",
+     [](SimConfig& c, const std::string& v) {
+       c.velocityLayout = parseChoice(v, VELOCITY_LAYOUTS);
+     }},
+    {"backtrace",
+     [](SimConfig& c, const std::string& v) {
+       c.backtraceOrder = parseChoice(v, BACKTRACES);
+     }},
+    {"velocity_advection",
+     [](SimConfig& c, const std::string& v) {
+       c.velocityAdvection = parseChoice(v, SCHEMES);
+     }},
+    {"density_advection",
+     [](SimConfig& c, const std::string& v) {
+       c.densityAdvection = parseChoice(v, SCHEMES);
+     }},
+    {"interpolation",
+     [](SimConfig& c, const std::string& v) {
+       c.interpolation = parseChoice(v, SAMPLERS);
+     }},
+    {"density_refinement",
+     [](SimConfig& c, const std::string& v) {
+       c.densityRefinement = parseSize(v);
+     }},
+    {"pressure_iterations",
+     [](SimConfig& c, const std::string& v) {
+       c.pressureIterations = parseSize(v);
+     }},
+    {"diffusion_iterations",
+     [](SimConfig& c, const std::string& v) {
+       c.diffusionIterations = parseSize(v);
+     }},
+    {"threads",
+     [](SimConfig& c, const std::string& v) { c.threads = parseSize(v); }},
+    {"pressure_tolerance",
+     [](SimConfig& c, const std::string& v) {
+       c.pressureTolerance = parseFloat(v);
+     }},
+    {"diffusion_tolerance",
+     [](SimConfig& c, const std::string& v) {
+       c.diffusionTolerance = parseFloat(v);
+     }},
+    {"stir",
+     [](SimConfig& c, const std::string& v) { c.stir = parseFloat(v); }},
+    {"force",
+     [](SimConfig& c, const std::string& v) { c.force = parseVec3(v); }},
+    {"seed",
+     [](SimConfig& c, const std::string& v) {
+       c.seed = static_cast<uint32_t>(parseSize(v));
+     }},
+    {"history_steps",
+     [](SimConfig& c, const std::string& v) {
+       c.historySteps = parseSize(v);
+     }},
+    {"history_memory",
+     [](SimConfig& c, const std::string& v) {
+       c.historyMemory = parseBytes(v);
+     }},
+    {"history_tolerance",
+     [](SimConfig& c, const std::string& v) {
+       c.historyTolerance = parseFloat(v);
+     }},
+    {"checkpoint",
+     [](SimConfig& c, const std::string& v) { c.checkpoint = v; }},
+    {"checkpoint_every",
+     [](SimConfig& c, const std::string& v) {
+       c.checkpointEvery = parseSize(v);
+     }},
+    {"restart", [](SimConfig& c, const std::string& v) { c.restart = v; }},
+    {"headless",
+     [](SimConfig& c, const std::string& v) { c.headless = parseBool(v); }},
+    {"print_slices",
+     [](SimConfig& c, const std::string& v) { c.printSlices = parseBool(v); }},
+    {"shared_frames",
+     [](SimConfig& c, const std::string& v) {
+       c.sharedFrames = parseBool(v);
+     }},
+    {"shared_frames_name",
+     [](SimConfig& c, const std::string& v) { c.sharedFramesName = v; }},
+    {"record", [](SimConfig& c, const std::string& v) { c.record = v; }},
+    {"vti", [](SimConfig& c, const std::string& v) { c.vti = v; }},
+    {"play", [](SimConfig& c, const std::string& v) { c.play = v; }},
+    {"output_region",
+     [](SimConfig& c, const std::string& v) {
+       c.outputRegion = parseOutputRegion(v);
+     }},
+    {"tracers",
+     [](SimConfig& c, const std::string& v) { c.tracers = parseSize(v); }},
+    {"trajectory",
+     [](SimConfig& c, const std::string& v) { c.trajectory = v; }},
+    {"keyframe_interval",
+     [](SimConfig& c, const std::string& v) {
+       c.keyframeInterval = parseSize(v);
+     }},
+    {"output_tolerance",
+     [](SimConfig& c, const std::string& v) {
+       c.outputTolerance = parseFloat(v);
+     }},
+}};
+
+}  // namespace
+
+void setConfigValue(SimConfig& config, const std::string& key,
+                    const std::string& value) {
+  for (const auto& [name, set] : KEYS) {
+    if (key != name) continue;
+    try {
+      set(config, value);
+    } catch (const std::exception& error) {
+      throw std::runtime_error(key + ": " + error.what());
+    }
+    return;
+  }
+  throw std::runtime_error("unknown setting '" + key + "'");
+}
+
+void loadConfig(const std::string& path, SimConfig& config) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("Cannot open config file: " + path);
+  }
+
+  std::string line;
+  for (size_t number = 1; std::getline(file, line); ++number) {
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty()) continue;
+
+    const size_t equals = line.find('=');
+    try {
+      if (equals == std::string::npos) {
+        throw std::runtime_error("expected key = value");
+      }
+      setConfigValue(config, trim(line.substr(0, equals)),
+                     trim(line.substr(equals + 1)));
+    } catch (const std::exception& error) {
+      throw std::runtime_error(path + ":" + std::to_string(number) + ": " +
+                               error.what());
+    }
+  }
+}
+
+SimConfig parseCommandLine(int argc, const char* const* argv) {
+  SimConfig config;
+  for (int i = 1; i < argc; ++i) {
+    const std::string argument = argv[i];
+    const size_t equals = argument.find('=');
+
+    if (argument == "--headless") {
+      config.headless = true;
+    } else if (argument == "--record" || argument == "--play") {
+      if (i + 1 == argc) {
+        throw std::runtime_error(argument + " needs a file");
+      }
+      setConfigValue(config, argument.substr(2), argv[++i]);
+    } else if (argument.rfind("--", 0) == 0) {
+      throw std::runtime_error("unknown option " + argument);
+    } else if (equals != std::string::npos) {
+      setConfigValue(config, argument.substr(0, equals),
+                     argument.substr(equals + 1));
+    } else {
+      loadConfig(argument, config);
+    }
+  }
+  return config;
+}
+
+Grid3D makeGrid(const SimConfig& config) {
+  if (config.nx == 0 || config.ny == 0 || config.nz == 0) {
+    throw std::runtime_error("Grid dimensions must be positive");
+  }
+  const Grid3D grid(config.nx, config.ny, config.nz, config.layout);
+  if (config.memoryLimit == 0) return grid;
+
+  // what a cell costs depends on the solver's choices (faces, refined
+  // density), so measure it on a small fluid set up like the real one
+  constexpr size_t PROBE_EDGE = 16;
+  const Grid3D probe(std::min(config.nx, PROBE_EDGE),
+                     std::min(config.ny, PROBE_EDGE),
+                     std::min(config.nz, PROBE_EDGE), config.layout);
+  Liquid fluid(probe, config.viscosity, config.diffusionRate);
+  configureFluid(config, probe, fluid);
+  const size_t bytesPerElement = fluid.fields.bytesPerElement();
+
+  if (grid.size() * bytesPerElement <= config.memoryLimit) return grid;
+  return fitGridToMemory(config.memoryLimit, bytesPerElement, config.nx,
+                         config.ny, config.nz, config.layout);
+}
+
+void configureFluid(const SimConfig& config, const Grid3D& grid,
+                    Liquid& fluid) {
+  setThreadCount(config.threads);
+
+  // the staggered step has its own semi-Lagrangian face advection, and
+  // FLIP particles replace velocity advection altogether
+  if (config.velocityLayout == VelocityLayout::Staggered &&
+      config.velocityAdvection != AdvectionScheme::SemiLagrangian) {
+    throw std::runtime_error(
+        "velocity_advection = maccormack needs velocity_layout = collocated");
+  }
+  if (config.solver == VelocitySolver::Flip) {
+    if (config.velocityLayout != VelocityLayout::Collocated) {
+      throw std::runtime_error(
+          "solver = flip needs velocity_layout = collocated");
+    }
+    if (config.velocityAdvection != AdvectionScheme::SemiLagrangian) {
+      throw std::runtime_error(
+          "velocity_advection has no effect with solver = flip");
+    }
+    if (config.flipRatio < 0.0F || config.flipRatio > 1.0F) {
+      throw std::runtime_error("flip_ratio must be between 0 and 1");
+    }
+  }
+
+  fluid.viscosity = config.viscosity;
+  fluid.diffusionRate = config.diffusionRate;
+  fluid.backtraceOrder = config.backtraceOrder;
+  fluid.velocityAdvection = config.velocityAdvection;
+  fluid.densityAdvection = config.densityAdvection;
+  fluid.interpolation = config.interpolation;
+  fluid.pressureIterations = config.pressureIterations;
+  fluid.diffusionIterations = config.diffusionIterations;
+  fluid.pressureTolerance = config.pressureTolerance;
+  fluid.diffusionTolerance = config.diffusionTolerance;
+
+  std::fill(fluid.density.begin(), fluid.density.end(),
+            config.initialDensity);
+  fluid.fields.markWritten(FIELD_DENSITY);
+  if (config.velocityLayout == VelocityLayout::Staggered) {
+    enableStaggeredVelocity(grid, fluid);
+  }
+  if (config.densityRefinement > 1) {
+    enableRefinedDensity(grid, fluid, config.densityRefinement);
+  }
+  if (config.surfaceHeight) {
+    if (config.surfaceBand <= 0.0F) {
+      throw std::runtime_error("surface_band must be positive");
+    }
+    const float height = *config.surfaceHeight;
+    fluid.surface =
+        std::make_unique<NarrowBandLevelSet>(grid, config.surfaceBand);
+    fluid.surface->initialise([height](const Vec3& pos) {
+      return pos.z - height;
+    });
+  }
+}
+
+std::mt19937 makeRandom(const SimConfig& config) {
+  if (config.seed != 0) return std::mt19937(config.seed);
+  std::random_device device;
+  return std::mt19937(device());
+}
+
+std::unique_ptr<FrameWriter> makeFrameWriter(const SimConfig& config) {
+  std::vector<std::unique_ptr<FrameSink>> sinks;
+  if (!config.record.empty()) {
+    sinks.push_back(std::make_unique<TimeSeriesWriter>(
+        config.record, config.keyframeInterval, config.outputRegion,
+        config.outputTolerance));
+  }
+  if (!config.vti.empty()) {
+    sinks.push_back(
+        std::make_unique<VtiWriter>(config.vti, config.outputRegion));
+  }
+  if (sinks.empty()) return nullptr;
+  return std::make_unique<FrameWriter>(std::move(sinks));
+}
@@ -0,0 +1,237 @@
+#include "simulation.hpp"
+
+#include "checkpoint.hpp"
+#include "field.hpp"
+#include "flip.hpp"
+#include "liquid.hpp"
+#include "mac_grid.hpp"
+#include "navier.hpp"
+#include "rollback_history.hpp"
+#include "sim_config.hpp"
+#include "tracers.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// the staggered step rebuilds the cell velocity from the faces, so that is
+// where the stirring has to go; returns the fastest speed afterwards
+float stirVelocity(float amount, Grid3D& grid, Liquid& fluid,
+                   std::mt19937& random) {
+  std::uniform_real_distribution<float> distrib(-amount, amount);
+
+  if (fluid.velocityLayout == VelocityLayout::Staggered) {
+    MacGrid mac(grid);
+    FaceVelocity faces = faceVelocity(fluid);
+    const auto stirFaces = [&](const Grid3D& faceGrid,
+                               Field<float>& faceField) {
+      for (size_t z = 0; z < faceGrid.nz; ++z) {
+        for (size_t y = 0; y < faceGrid.ny; ++y) {
+          for (size_t x = 0; x < faceGrid.nx; ++x) {
+            faceField[faceGrid.offset(x, y, z)] += distrib(random);
+          }
+        }
+      }
+    };
+    stirFaces(mac.uFaces, faces.u);
+    stirFaces(mac.vFaces, faces.v);
+    stirFaces(mac.wFaces, faces.w);
+    markFacesWritten(fluid);
+    fluid.fields.markWritten(FIELD_VELOCITY);
+    return facesToCells(mac, faces, fluid.velocity);
+  }
+
+  float maxSpeedSquared = 0.0F;
+  for (size_t z = 0; z < grid.nz; ++z) {
+    for (size_t y = 0; y < grid.ny; ++y) {
+      for (size_t x = 0; x < grid.nx; ++x) {
+        Vec3& vel = fluid.velocity[grid.offset(x, y, z)];
+        vel += Vec3{distrib(random), distrib(random), distrib(random)};
+        maxSpeedSquared = std::max(
+            maxSpeedSquared, vel.x * vel.x + vel.y * vel.y + vel.z * vel.z);
+      }
+    }
+  }
+  fluid.fields.markWritten(FIELD_VELOCITY);
+  return std::sqrt(maxSpeedSquared);
+}
+
+float fastestSpeed(const Grid3D& grid, const Liquid& fluid) {
+  float maxSpeedSquared = 0.0F;
+  for (size_t z = 0; z < grid.nz; ++z) {
+    for (size_t y = 0; y < grid.ny; ++y) {
+      for (size_t x = 0; x < grid.nx; ++x) {
+        const Vec3& vel = fluid.velocity[grid.offset(x, y, z)];
+        maxSpeedSquared = std::max(
+            maxSpeedSquared, vel.x * vel.x + vel.y * vel.y + vel.z * vel.z);
+      }
+    }
+  }
+  return std::sqrt(maxSpeedSquared);
+}
+
+}  // namespace
+
+Simulation::Simulation(const SimConfig& simConfig,
+                       std::shared_ptr<const FieldStorage> storage)
+    : grid(makeGrid(simConfig)),
+      fluid(grid, simConfig.viscosity, simConfig.diffusionRate,
+            FieldAllocator<float>(std::move(storage))),
+      config(simConfig),
+      controller(simConfig.timestep),
+      random(makeRandom(simConfig)) {
+  configureFluid(config, grid, fluid);
+
+  // particles and the surface live outside the field registry, so a
+  // checkpoint cannot hold them
+  if (!config.checkpoint.empty() || !config.restart.empty()) {
+    if (config.solver == VelocitySolver::Flip) {
+      throw std::runtime_error("checkpoints need solver = grid");
+    }
+    if (config.surfaceHeight) {
+      throw std::runtime_error("checkpoints cannot hold surface_height");
+    }
+  }
+  if (!config.restart.empty()) {
+    const CheckpointView checkpoint(config.restart);
+    restoreCheckpoint(checkpoint, grid, fluid);
+    steps = checkpoint.header().step;
+    lastTimeStep = checkpoint.header().timeStep;
+    fluid.maxSpeed = fastestSpeed(grid, fluid);
+  }
+
+  if (config.solver == VelocitySolver::Flip) {
+    // the particles keep state the history cannot restore
+    if (config.historySteps > 0) {
+      throw std::runtime_error("history_steps needs solver = grid");
+    }
+    FlipSettings settings;
+    settings.flipRatio = config.flipRatio;
+    settings.particlesPerCell = config.particlesPerCell;
+    if (config.seed != 0) settings.seed = config.seed;
+    flip = std::make_unique<FlipSolver>(fluid, settings);
+    const Vec3 upper{static_cast<float>(grid.nx),
+                     static_cast<float>(grid.ny),
+                     static_cast<float>(grid.nz)};
+    flip->seedBox(grid, {}, upper);
+  }
+
+  if (config.historySteps > 0) {
+    // the level set lives outside the registry, so a rewind would leave
+    // the surface behind
+    if (config.surfaceHeight) {
+      throw std::runtime_error("history_steps cannot hold surface_height");
+    }
+    history =std::make_unique<RollbackHistory>(HistoryConfig{
+        config.historySteps, config.historyMemory, config.historyTolerance});
+    history->record(steps, fluid);
+  }
+  if ((config.tracers > 0) != !config.trajectory.empty()) {
+    throw std::runtime_error("tracers and trajectory must be set together");
+  }
+  if (config.tracers > 0) {
+    // spread over the whole grid, seeded from a stream of their own so
+    // adding tracers does not change the stirring
+    tracers = std::make_unique<TracerSystem>();
+    const Vec3 upper{static_cast<float>(grid.nx - 1),
+                     static_cast<float>(grid.ny - 1),
+                     static_cast<float>(grid.nz - 1)};
+    tracers->seedBox({}, upper, config.tracers,
+                     static_cast<uint32_t>(makeRandom(config)()));
+    trajectory =
+        std::make_unique<TrajectoryWriter>(config.trajectory, config.tracers);
+  }
+}
+
+size_t Simulation::advanceFrame() {
+  // the first step's size comes from maxSpeed, so it must include the
+  // stirring
+  const float stir = config.stir.value_or(
+      config.headless ? 0.0F : SimConfig::DEFAULT_STIR);
+  if (stir > 0.0F) {
+    // FLIP rebuilds the grid velocity from its particles every step
+    fluid.maxSpeed = flip ? flip->stir(stir, random)
+                          : stirVelocity(stir, grid, fluid, random);
+  }
+
+  // every solver adds gravity to the configured force, so both bound the
+  // step
+  const Vec3& force = config.force;
+  const Vec3 applied = GRAVITY + force;
+  const float acceleration = std::sqrt(
+      applied.x * applied.x + applied.y * applied.y + applied.z * applied.z);
+  const bool forced =
+      force.x * force.x + force.y * force.y + force.z * force.z > 0.0F;
+  const size_t substeps = controller.advance(
+      config.frameTime, fluid,
+      [&](float timeStep) {
+        if (flip) {
+          flip->step(grid, fluid, timeStep, force);
+          stepScalars(grid, fluid, timeStep);
+        } else {
+          if (forced) {
+            applyForces(timeStep, force, fluid);
+          }
+          simulateStep(grid, fluid, timeStep);
+        }
+        ++steps;
+        lastTimeStep = timeStep;
+        if (history) {
+          history->record(steps, fluid);
+        }
+        if (tracers) {
+          tracers->advect(grid, fluid.velocity, timeStep);
+        }
+      },
+      acceleration);
+
+  elapsed += config.frameTime;
+  if (trajectory) {
+    trajectory->record(frames, elapsed, *tracers);
+  }
+  ++frames;
+  if (!config.checkpoint.empty() && config.checkpointEvery > 0 &&
+      frames % config.checkpointEvery == 0) {
+    writeCheckpoint(config.checkpoint, grid, fluid, steps, lastTimeStep);
+  }
+  return substeps;
+}
+
+std::optional<size_t> Simulation::rewind(size_t stepsBack) {
+  if (!history) return std::nullopt;
+
+  const std::vector<size_t> held = history->steps();
+  const size_t target = steps > stepsBack ? steps - stepsBack : 0;
+  size_t chosen = held.front();
+  for (const size_t recorded : held) {
+    if (recorded <= target) chosen = recorded;
+  }
+  history->restore(chosen, fluid);
+  steps = chosen;
+
+  // the next step's size depends on the restored speed
+  fluid.maxSpeed = fastestSpeed(grid, fluid);
+  return chosen;
+}
+
+void Simulation::finish() {
+  if (trajectory) {
+    trajectory->close();
+  }
+  // unless the last frame already wrote it
+  const bool saved =
+      config.checkpointEvery > 0 && frames % config.checkpointEvery == 0;
+  if (!config.checkpoint.empty() && !saved) {
+    writeCheckpoint(config.checkpoint, grid, fluid, steps, lastTimeStep);
+  }
+}
@@ -0,0 +1,36 @@
+#include "snapshot.hpp"
+
+#include "field_registry.hpp"
+#include "liquid.hpp"
+#include "vector_math.hpp"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+std::shared_ptr<const LiquidSnapshot> SnapshotPublisher::publish(
+    size_t step, const Grid3D& grid, const Liquid& fluid) {
+  // only the solver thread publishes, so previous stays the newest snapshot
+  // while the next one is built against it
+  const std::shared_ptr<const LiquidSnapshot> previous = latest();
+  const LiquidSnapshot* base = previous.get();
+
+  const FieldRegistry& fields = fluid.fields;
+  auto snapshot = std::make_shared<const LiquidSnapshot>(LiquidSnapshot{
+      step, grid,
+      FieldSnapshot<Vec3>(fluid.velocity, fields.writeStamps(FIELD_VELOCITY),
+                          base != nullptr ? &base->velocity : nullptr),
+      FieldSnapshot<float>(fluid.density, fields.writeStamps(FIELD_DENSITY),
+                           base != nullptr ? &base->density : nullptr),
+      FieldSnapshot<float>(fluid.pressure,
+                           fields.writeStamps(FIELD_PRESSURE),
+                           base != nullptr ? &base->pressure : nullptr)});
+
+  const std::lock_guard<std::mutex> lock(mutex);
+  current = snapshot;
+  return snapshot;
+}
+
+std::shared_ptr<const LiquidSnapshot> SnapshotPublisher::latest() const {
+  const std::lock_guard<std::mutex> lock(mutex);
+  return current;
+}
@@ -0,0 +1,283 @@
+#include "sweep.hpp"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "frame_writer.hpp"
+#include "liquid.hpp"
+#include "sim_config.hpp"
+#include "simulation.hpp"
+#include "snapshot.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// what a child sends back through its pipe
+struct ChildReport {
+  RunSummary summary;
+  uint32_t ok;
+  std::array<char, 244> error;  // nul terminated
+};
+
+struct Child {
+  size_t run;
+  int pipe;
+};
+
+void reportFailure(ChildReport& report, const char* what) {
+  report.ok = 0;
+  const size_t length = std::min(std::strlen(what), report.error.size() - 1);
+  std::memcpy(report.error.data(), what, length);
+  report.error[length] = '\0';
+}
+
+// body of a child process; never returns
+[[noreturn]] void runChild(const SimConfig& config, int pipe) {
+  ChildReport report{};
+  try {
+    report.summary = runHeadless(config);
+    report.ok = 1;
+  } catch (const std::exception& error) {
+    reportFailure(report, error.what());
+  }
+
+  const auto* bytes = reinterpret_cast<const char*>(&report);
+  size_t written = 0;
+  while (written < sizeof(report)) {
+    const ssize_t count =
+        write(pipe, bytes + written, sizeof(report) - written);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) break;
+    written += static_cast<size_t>(count);
+  }
+  close(pipe);
+  // skip the parent's exit handlers and static destructors
+  _exit(report.ok != 0 ? 0 : 1);
+}
+
+bool readReport(int pipe, ChildReport& report) {
+  auto* bytes = reinterpret_cast<char*>(&report);
+  size_t done = 0;
+  while (done < sizeof(report)) {
+    const ssize_t count = read(pipe, bytes + done, sizeof(report) - done);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) return false;
+    done += static_cast<size_t>(count);
+  }
+  return true;
+}
+
+std::string csvField(const std::string& text) {
+  if (text.find_first_of(",\"\n") == std::string::npos) return text;
+  std::string quoted = "\"";
+  for (const char c : text) {
+    quoted += c;
+    if (c == '"') quoted += '"';
+  }
+  return quoted + "\"";
+}
+
+}  // namespace
+
+std::vector<SweepRun> expandSweep(const SimConfig& base,
+                                  const std::vector<SweepAxis>& axes) {
+  size_t total = 1;
+  for (const SweepAxis& axis : axes) {
+    if (axis.values.empty()) {
+      throw std::runtime_error("Sweep of " + axis.key + " has no values");
+    }
+    total *= axis.values.size();
+  }
+
+  std::vector<SweepRun> runs;
+  runs.reserve(total);
+  for (size_t index = 0; index < total; ++index) {
+    SweepRun run{base, {}};
+    // mixed-radix digits of index, last axis fastest
+    size_t rest = index;
+    run.values.resize(axes.size());
+    for (size_t a = axes.size(); a-- > 0;) {
+      run.values[a] = axes[a].values[rest % axes[a].values.size()];
+      rest /= axes[a].values.size();
+    }
+    for (size_t a = 0; a < axes.size(); ++a) {
+      setConfigValue(run.config, axes[a].key, run.values[a]);
+    }
+
+    const std::string suffix = "_" + std::to_string(index);
+    if (!run.config.record.empty()) run.config.record += suffix;
+    if (!run.config.vti.empty()) run.config.vti += suffix;
+    if (!run.config.checkpoint.empty()) run.config.checkpoint += suffix;
+    if (!run.config.trajectory.empty()) run.config.trajectory += suffix;
+    runs.push_back(std::move(run));
+  }
+  return runs;
+}
+
+RunSummary runHeadless(const SimConfig& config) {
+  Simulation run(config);
+  const Grid3D& grid = run.grid;
+  const Liquid& fluid = run.fluid;
+  SnapshotPublisher publisher;
+  const std::unique_ptr<FrameWriter> writer = makeFrameWriter(config);
+
+  RunSummary summary{};
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t frame = 0; frame < config.frames; ++frame) {
+    summary.steps += run.advanceFrame();
+    if (writer) {
+      writer->submit(publisher.publish(frame, grid, fluid));
+    }
+  }
+  if (writer) {
+    writer->close();
+  }
+  run.finish();
+  summary.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+  summary.maxSpeed = fluid.maxSpeed;
+  summary.densityMin = std::numeric_limits<float>::max();
+  summary.densityMax = std::numeric_limits<float>::lowest();
+  for (size_t z = 0; z < grid.nz; ++z) {
+    for (size_t y = 0; y < grid.ny; ++y) {
+      for (size_t x = 0; x < grid.nx; ++x) {
+        const size_t index = grid.offset(x, y, z);
+        const float density = fluid.density[index];
+        const Vec3& v = fluid.velocity[index];
+        summary.densityMass += static_cast<double>(density);
+        summary.densityMin = std::min(summary.densityMin, density);
+        summary.densityMax = std::max(summary.densityMax, density);
+        summary.kineticEnergy +=
+            0.5 * static_cast<double>(v.x * v.x + v.y * v.y + v.z * v.z);
+      }
+    }
+  }
+  return summary;
+}
+
+std::vector<SweepResult> runSweep(const std::vector<SweepRun>& runs,
+                                  size_t jobs, std::ostream& progress) {
+  jobs = std::max<size_t>(jobs, 1);
+  std::vector<SweepResult> results(runs.size());
+  std::map<pid_t, Child> children;
+  size_t next = 0;
+  size_t finished = 0;
+
+  while (next < runs.size() || !children.empty()) {
+    while (children.size() < jobs && next < runs.size()) {
+      std::array<int, 2> ends{};
+      if (pipe(ends.data()) != 0) {
+        throw std::runtime_error(std::string("Cannot create pipe: ") +
+                                 std::strerror(errno));
+      }
+      // anything still buffered would otherwise be written by the child too
+      std::cout.flush();
+      std::fflush(nullptr);
+      const pid_t pid = fork();
+      if (pid < 0) {
+        close(ends[0]);
+        close(ends[1]);
+        throw std::runtime_error(std::string("Cannot fork: ") +
+                                 std::strerror(errno));
+      }
+      if (pid == 0) {
+        close(ends[0]);
+        runChild(runs[next].config, ends[1]);
+      }
+      close(ends[1]);
+      children[pid] = {next++, ends[0]};
+    }
+
+    int status = 0;
+    const pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) continue;
+      throw std::runtime_error(std::string("Cannot wait for runs: ") +
+                               std::strerror(errno));
+    }
+    const auto found = children.find(pid);
+    if (found == children.end()) continue;
+    const Child child = found->second;
+    children.erase(found);
+
+    ChildReport report{};
+    const bool received = readReport(child.pipe, report);
+    close(child.pipe);
+
+    SweepResult& result = results[child.run];
+    if (received) {
+      result.ok = report.ok != 0;
+      result.summary = report.summary;
+      result.error = report.ok != 0 ? "" : report.error.data();
+    } else if (WIFSIGNALED(status)) {
+      result.error = "killed by signal " + std::to_string(WTERMSIG(status));
+    } else {
+      result.error = "exited without a result";
+    }
+
+    progress << "[" << ++finished << "/" << runs.size() << "] run "
+             << child.run << ": ";
+    if (result.ok) {
+      progress << result.summary.seconds << " s, " << result.summary.steps
+               << " steps\n";
+    } else {
+      progress << "failed: " << result.error << "\n";
+    }
+  }
+  return results;
+}
+
+void writeSweepCsv(std::ostream& out, const std::vector<SweepAxis>& axes,
+                   const std::vector<SweepRun>& runs,
+                   const std::vector<SweepResult>& results) {
+  out << "run";
+  for (const SweepAxis& axis : axes) {
+    out << "," << csvField(axis.key);
+  }
+  out << ",status,seconds,steps,cell_steps_per_second,max_speed,"
+         "density_mass,density_min,density_max,kinetic_energy,error\n";
+
+  for (size_t i = 0; i < runs.size(); ++i) {
+    const SimConfig& config = runs[i].config;
+    const SweepResult& result = results[i];
+    const RunSummary& summary = result.summary;
+
+    out << i;
+    for (const std::string& value : runs[i].values) {
+      out << "," << csvField(value);
+    }
+    if (!result.ok) {
+      out << ",failed,,,,,,,,," << csvField(result.error) << "\n";
+      continue;
+    }
+    const double cellSteps = static_cast<double>(config.nx * config.ny *
+                                                 config.nz) *
+                             static_cast<double>(summary.steps);
+    out << ",ok," << summary.seconds << "," << summary.steps << ","
+        << (summary.seconds > 0.0 ? cellSteps / summary.seconds : 0.0) << ","
+        << summary.maxSpeed << "," << summary.densityMass << ","
+        << summary.densityMin << "," << summary.densityMax << ","
+        << summary.kineticEnergy << ",\n";
+  }
+}
@@ -0,0 +1,490 @@
+#include "time_series.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block_compression.hpp"
+#include "compression.hpp"
+#include "field.hpp"
+#include "output_region.hpp"
+#include "snapshot.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// version 2 added the codec byte; version 1 files read as lossless
+constexpr uint32_t SERIES_VERSION = 2;
+constexpr std::array<char, 8> SERIES_MAGIC = {'F', 'S', 'S', 'E',
+                                              'R', 'I', 'E', 'S'};
+constexpr std::array<char, 8> INDEX_MAGIC = {'F', 'S', 'I', 'N',
+                                             'D', 'E', 'X', '1'};
+// every channel holds floats, so bytes are shuffled in groups of four
+constexpr size_t WORD_BYTES = sizeof(float);
+
+// what a block-coded channel holds
+enum class BlockChannel : uint8_t {
+  Values,    // the frame itself; always on keyframes
+  Residuals  // the change from the previous frame as decoded
+};
+
+// leads each frame record; the channels follow in order
+struct FrameRecord {
+  uint64_t step;
+  std::array<uint64_t, SERIES_CHANNELS> channelBytes;
+};
+
+std::runtime_error systemError(const std::string& what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+template <typename T>
+void flatten(const FieldSnapshot<T>& field, std::vector<uint8_t>& bytes) {
+  bytes.resize(field.size() * sizeof(T));
+  uint8_t* out = bytes.data();
+  for (size_t t = 0; t < field.tileCount(); ++t) {
+    const std::vector<T>& tile = field.tile(t);
+    std::memcpy(out, tile.data(), tile.size() * sizeof(T));
+    out += tile.size() * sizeof(T);
+  }
+}
+
+// cells of region in x-fastest order, or the whole storage when it covers
+// the grid
+template <typename T>
+void recordedBytes(const Grid3D& grid, const FieldSnapshot<T>& field,
+                   const OutputRegion& region, std::vector<T>& cells,
+                   std::vector<uint8_t>& bytes) {
+  if (region.covers(grid)) {
+    flatten(field, bytes);
+    return;
+  }
+  extractRegion(grid, field, region, cells);
+  bytes.resize(cells.size() * sizeof(T));
+  std::memcpy(bytes.data(), cells.data(), bytes.size());
+}
+
+void xorInto(std::vector<uint8_t>& target, const std::vector<uint8_t>& other) {
+  for (size_t i = 0; i < target.size(); ++i) {
+    target[i] ^= other[i];
+  }
+}
+
+template <typename T>
+void unflatten(const std::vector<uint8_t>& bytes, Field<T>& field) {
+  field.resize(bytes.size() / sizeof(T));
+  std::memcpy(static_cast<void*>(field.data()), bytes.data(), bytes.size());
+}
+
+template <typename T>
+uint8_t* bytesOf(Field<T>& field) {
+  return static_cast<uint8_t*>(static_cast<void*>(field.data()));
+}
+
+// adds sign times each float word of other to the word of target
+void addWords(uint8_t* target, const uint8_t* other, size_t bytes,
+              float sign) {
+  for (size_t at = 0; at < bytes; at += WORD_BYTES) {
+    float value = 0.0F;
+    float change = 0.0F;
+    std::memcpy(&value, target + at, WORD_BYTES);
+    std::memcpy(&change, other + at, WORD_BYTES);
+    value += sign * change;
+    std::memcpy(target + at, &value, WORD_BYTES);
+  }
+}
+
+// largest magnitude of any word, or infinity if one is not finite
+float largestWord(const std::vector<uint8_t>& bytes) {
+  float largest = 0.0F;
+  for (size_t at = 0; at < bytes.size(); at += WORD_BYTES) {
+    float value = 0.0F;
+    std::memcpy(&value, bytes.data() + at, WORD_BYTES);
+    if (!std::isfinite(value)) return HUGE_VALF;
+    largest = std::max(largest, std::fabs(value));
+  }
+  return largest;
+}
+
+// whether every cell of decoded is within tolerance of the same cell of
+// bytes; padding between them is ignored
+template <typename T>
+bool withinTolerance(const Grid3D& grid, const std::vector<uint8_t>& bytes,
+                     const std::vector<uint8_t>& decoded, float tolerance) {
+  for (size_t z = 0; z < grid.nz; ++z) {
+    for (size_t y = 0; y < grid.ny; ++y) {
+      for (size_t x = 0; x < grid.nx; ++x) {
+        const size_t first = grid.offset(x, y, z) * sizeof(T);
+        for (size_t at = first; at < first + sizeof(T); at += WORD_BYTES) {
+          float value = 0.0F;
+          float stored = 0.0F;
+          std::memcpy(&value, bytes.data() + at, WORD_BYTES);
+          std::memcpy(&stored, decoded.data() + at, WORD_BYTES);
+          // identical words also cover infinities
+          if (std::memcmp(&value, &stored, WORD_BYTES) == 0) continue;
+          if (!(std::fabs(static_cast<double>(value) -
+                          static_cast<double>(stored)) <=
+                static_cast<double>(tolerance))) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// a block-coded channel leads with a BlockChannel byte: its values replace
+// decoded, its residuals are added to it
+template <typename T>
+void decodeBlocks(const Grid3D& grid, const std::vector<uint8_t>& encoded,
+                  std::vector<uint8_t>& decoded, Field<T>& scratch) {
+  if (encoded.empty() ||
+      encoded.front() > static_cast<uint8_t>(BlockChannel::Residuals)) {
+    throw std::runtime_error("Time series channel is corrupt");
+  }
+  const bool residuals =
+      encoded.front() == static_cast<uint8_t>(BlockChannel::Residuals);
+  const std::vector<uint8_t> payload(encoded.begin() + 1, encoded.end());
+  // cells the codec skips, such as tile padding, must not keep old values
+  scratch.assign(grid.size(), T{});
+  decompressBlocks(grid, payload, scratch);
+  const size_t bytes = scratch.size() * sizeof(T);
+  if (!residuals) {
+    decoded.resize(bytes);
+    std::memcpy(decoded.data(), bytesOf(scratch), bytes);
+    return;
+  }
+  if (decoded.size() != bytes) {
+    throw std::runtime_error("Time series residuals have no frame to add to");
+  }
+  addWords(decoded.data(), bytesOf(scratch), bytes, 1.0F);
+}
+
+template <typename T>
+std::vector<uint8_t> encodeBlocks(const Grid3D& grid, float tolerance,
+                                  BlockChannel kind,
+                                  const std::vector<uint8_t>& bytes,
+                                  const std::vector<uint8_t>& decoded,
+                                  Field<T>& scratch) {
+  unflatten(bytes, scratch);
+  float base = 0.0F;
+  if (kind == BlockChannel::Residuals) {
+    addWords(bytesOf(scratch), decoded.data(), bytes.size(), -1.0F);
+    base = largestWord(decoded);
+  }
+  std::vector<uint8_t> encoded =
+      compressBlocks(grid, scratch, tolerance, base);
+  encoded.insert(encoded.begin(), static_cast<uint8_t>(kind));
+  return encoded;
+}
+
+// residuals are taken against decoded, the previous frame as the reader
+// has it, rather than the exact one, so errors never build up across a
+// run of them. they are kept only when the reader's sum stays within
+// tolerance, which the float rounding of values near the tolerance can
+// break; the frame's values are coded instead. decoded is updated exactly
+// as the reader will update it
+template <typename T>
+std::vector<uint8_t> encodeBlocks(const Grid3D& grid, float tolerance,
+                                  bool keyframe,
+                                  const std::vector<uint8_t>& bytes,
+                                  std::vector<uint8_t>& decoded,
+                                  std::vector<uint8_t>& candidate,
+                                  Field<T>& scratch) {
+  if (!keyframe) {
+    std::vector<uint8_t> encoded = encodeBlocks(
+        grid, tolerance, BlockChannel::Residuals, bytes, decoded, scratch);
+    candidate = decoded;
+    decodeBlocks(grid, encoded, candidate, scratch);
+    if (withinTolerance<T>(grid, bytes, candidate, tolerance)) {
+      decoded.swap(candidate);
+      return encoded;
+    }
+  }
+  std::vector<uint8_t> encoded = encodeBlocks(
+      grid, tolerance, BlockChannel::Values, bytes, decoded, scratch);
+  decodeBlocks(grid, encoded, decoded, scratch);
+  return encoded;
+}
+
+}  // namespace
+
+TimeSeriesWriter::TimeSeriesWriter(const std::string& path,
+                                   size_t keyframeInterval,
+                                   OutputRegion region, float tolerance)
+    : file(path, std::ios::binary | std::ios::trunc),
+      filePath(path),
+      interval(std::max<size_t>(keyframeInterval, 1)),
+      outputRegion(region),
+      errorTolerance(tolerance) {
+  if (!(tolerance >= 0.0F)) {
+    throw std::runtime_error("Time series tolerance must not be negative");
+  }
+  if (!file.is_open()) {
+    throw std::runtime_error("Cannot open time series file: " + path);
+  }
+}
+
+TimeSeriesWriter::~TimeSeriesWriter() {
+  try {
+    finish();
+  } catch (...) {
+    // nothing can be reported from a destructor; call finish() to see it
+  }
+}
+
+void TimeSeriesWriter::append(const void* data, size_t size) {
+  file.write(static_cast<const char*>(data),
+             static_cast<std::streamsize>(size));
+  if (!file) {
+    throw std::runtime_error("Cannot write time series file: " + filePath);
+  }
+  position += size;
+}
+
+void TimeSeriesWriter::write(const LiquidSnapshot& frame) {
+  if (finished) {
+    throw std::runtime_error("Time series is already finished");
+  }
+
+  const Grid3D& grid = frame.grid;
+  if (index.empty()) {
+    outputRegion = outputRegion.clippedTo(grid);
+    sourceSize = {grid.nx, grid.ny, grid.nz};
+    const bool whole = outputRegion.covers(grid);
+    const std::array<size_t, 3> cells = outputRegion.extent();
+
+    header.magic = SERIES_MAGIC;
+    header.version = SERIES_VERSION;
+    header.keyframeInterval = static_cast<uint32_t>(interval);
+    header.nx = cells[0];
+    header.ny = cells[1];
+    header.nz = cells[2];
+    for (size_t a = 0; a < 3; ++a) {
+      header.origin[a] = outputRegion.begin[a];
+    }
+    header.stride = static_cast<uint32_t>(outputRegion.stride);
+    header.layout = static_cast<uint8_t>(whole ? grid.layout
+                                               : GridLayout::Linear);
+    header.codec = static_cast<uint8_t>(errorTolerance > 0.0F
+                                            ? SeriesCodec::Blocks
+                                            : SeriesCodec::Lossless);
+    append(&header, sizeof(header));
+  } else if (sourceSize != std::array<size_t, 3>{grid.nx, grid.ny, grid.nz}) {
+    throw std::runtime_error("Time series frames must share one grid");
+  }
+
+  recordedBytes(grid, frame.velocity, outputRegion, velocityCells,
+                current[0]);
+  recordedBytes(grid, frame.density, outputRegion, scalarCells, current[1]);
+  recordedBytes(grid, frame.pressure, outputRegion, scalarCells, current[2]);
+
+  const bool keyframe = index.size() % interval == 0;
+  const bool blocks =
+      header.codec == static_cast<uint8_t>(SeriesCodec::Blocks);
+  const Grid3D recorded(header.nx, header.ny, header.nz,
+                        static_cast<GridLayout>(header.layout));
+  std::array<std::vector<uint8_t>, SERIES_CHANNELS> encoded;
+  FrameRecord record{frame.step, {}};
+  for (size_t c = 0; c < SERIES_CHANNELS; ++c) {
+    std::vector<uint8_t>& bytes = current[c];
+    if (blocks && c == 0) {
+      encoded[c] = encodeBlocks(recorded, errorTolerance, keyframe, bytes,
+                                previous[c], candidate, velocityScratch);
+    } else if (blocks) {
+      encoded[c] = encodeBlocks(recorded, errorTolerance, keyframe, bytes,
+                                previous[c], candidate, scalarScratch);
+    } else if (keyframe) {
+      encoded[c] = encodeBytes(bytes.data(), bytes.size(), WORD_BYTES);
+    } else {
+      // XOR in place, encode, then undo so current holds this frame again
+      xorInto(bytes, previous[c]);
+      encoded[c] = encodeBytes(bytes.data(), bytes.size(), WORD_BYTES);
+      xorInto(bytes, previous[c]);
+    }
+    record.channelBytes[c] = encoded[c].size();
+  }
+
+  index.push_back({frame.step, position, static_cast<uint8_t>(keyframe), {}});
+  append(&record, sizeof(record));
+  for (const std::vector<uint8_t>& channel : encoded) {
+    append(channel.data(), channel.size());
+  }
+  // the block codec has already left the decoded frame in previous
+  if (!blocks) {
+    previous.swap(current);
+  }
+}
+
+void TimeSeriesWriter::finish() {
+  if (finished) return;
+  finished = true;
+
+  const SeriesTrailer trailer{position, index.size(), INDEX_MAGIC};
+  append(index.data(), index.size() * sizeof(SeriesIndexEntry));
+  append(&trailer, sizeof(trailer));
+  file.flush();
+}
+
+TimeSeriesReader::TimeSeriesReader(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw systemError("Cannot open time series " + path);
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw systemError("Cannot stat time series " + path);
+  }
+  length = static_cast<size_t>(info.st_size);
+  if (length < sizeof(SeriesHeader) + sizeof(SeriesTrailer)) {
+    close(fd);
+    throw std::runtime_error("Time series too short: " + path);
+  }
+
+  void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    throw systemError("Cannot map time series " + path);
+  }
+  data = static_cast<const uint8_t*>(mapped);
+
+  SeriesTrailer trailer{};
+  std::memcpy(&header, data, sizeof(header));
+  std::memcpy(&trailer, data + length - sizeof(trailer), sizeof(trailer));
+  const size_t indexBytes = trailer.frameCount * sizeof(SeriesIndexEntry);
+  if (header.magic != SERIES_MAGIC || header.version == 0 ||
+      header.version > SERIES_VERSION ||
+      header.codec > static_cast<uint8_t>(SeriesCodec::Blocks) ||
+      trailer.magic != INDEX_MAGIC ||
+      trailer.indexOffset + indexBytes + sizeof(trailer) != length) {
+    munmap(mapped, length);
+    throw std::runtime_error("Not a finished time series: " + path);
+  }
+
+  entries.resize(trailer.frameCount);
+  std::memcpy(entries.data(), data + trailer.indexOffset, indexBytes);
+  if (!entries.empty() && entries.front().keyframe == 0) {
+    munmap(mapped, length);
+    throw std::runtime_error("Time series does not start with a keyframe");
+  }
+}
+
+TimeSeriesReader::~TimeSeriesReader() {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  munmap(const_cast<uint8_t*>(data), length);
+}
+
+Grid3D TimeSeriesReader::grid() const {
+  return {header.nx, header.ny, header.nz,
+          static_cast<GridLayout>(header.layout)};
+}
+
+OutputRegion TimeSeriesReader::region() const {
+  const size_t stride = header.stride;
+  const std::array<size_t, 3> cells = {header.nx, header.ny, header.nz};
+  OutputRegion recorded;
+  recorded.stride = stride;
+  for (size_t a = 0; a < 3; ++a) {
+    recorded.begin[a] = header.origin[a];
+    recorded.end[a] = header.origin[a] + (cells[a] - 1) * stride + 1;
+  }
+  return recorded;
+}
+
+size_t TimeSeriesReader::findStep(uint64_t step) const {
+  const auto it = std::lower_bound(
+      entries.begin(), entries.end(), step,
+      [](const SeriesIndexEntry& e, uint64_t value) { return e.step < value; });
+  return static_cast<size_t>(it - entries.begin());
+}
+
+void TimeSeriesReader::apply(size_t frame) {
+  const SeriesIndexEntry& at = entries[frame];
+  FrameRecord record{};
+  if (at.offset + sizeof(record) > length) {
+    throw std::runtime_error("Time series frame is truncated");
+  }
+  std::memcpy(&record, data + at.offset, sizeof(record));
+
+  const size_t cells = grid().size();
+  const std::array<size_t, SERIES_CHANNELS> channelSizes = {
+      cells * sizeof(Vec3), cells * sizeof(float), cells * sizeof(float)};
+
+  size_t offset = at.offset + sizeof(record);
+  std::vector<uint8_t> decodedBytes;
+  for (size_t c = 0; c < SERIES_CHANNELS; ++c) {
+    const size_t size = record.channelBytes[c];
+    if (offset + size > length) {
+      throw std::runtime_error("Time series frame is truncated");
+    }
+    const std::vector<uint8_t> encoded(data + offset, data + offset + size);
+    offset += size;
+
+    if (header.codec == static_cast<uint8_t>(SeriesCodec::Blocks)) {
+      if (c == 0) {
+        decodeBlocks(grid(), encoded, state[c], velocityScratch);
+      } else {
+        decodeBlocks(grid(), encoded, state[c], scalarScratch);
+      }
+    } else if (at.keyframe != 0) {
+      state[c].resize(channelSizes[c]);
+      decodeBytes(encoded, state[c].data(), channelSizes[c], WORD_BYTES);
+    } else {
+      decodedBytes.resize(channelSizes[c]);
+      decodeBytes(encoded, decodedBytes.data(), channelSizes[c], WORD_BYTES);
+      xorInto(state[c], decodedBytes);
+    }
+  }
+  decoded = frame;
+}
+
+void TimeSeriesReader::prefetch(size_t first, size_t count) const {
+  if (first >= entries.size() || count == 0) return;
+  const size_t last = std::min(first + count, entries.size());
+  const uint64_t end = last < entries.size()
+                           ? entries[last].offset
+                           : length - sizeof(SeriesTrailer) -
+                                 entries.size() * sizeof(SeriesIndexEntry);
+
+  // madvise wants a page-aligned start
+  const auto page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  const uint64_t begin = entries[first].offset / page * page;
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  madvise(const_cast<uint8_t*>(data) + begin, end - begin, MADV_WILLNEED);
+}
+
+void TimeSeriesReader::read(size_t frame, SeriesFrame& out) {
+  if (frame >= entries.size()) {
+    throw std::runtime_error("Time series frame out of range");
+  }
+
+  // carry on from the decoded frame when it is on the way, otherwise
+  // start again from the keyframe
+  size_t next = frame;
+  while (entries[next].keyframe == 0) --next;
+  if (decoded != SIZE_MAX && decoded >= next && decoded <= frame) {
+    next = decoded + 1;
+  }
+  for (; next <= frame; ++next) {
+    apply(next);
+  }
+
+  out.step = entries[frame].step;
+  unflatten(state[0], out.velocity);
+  unflatten(state[1], out.density);
+  unflatten(state[2], out.pressure);
+}
@@ -0,0 +1,46 @@
+#include "timestep.hpp"
+
+#include "liquid.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+
+float TimestepController::stableStep(float maxSpeed,
+                                     float acceleration) const {
+  // the force adds acceleration * step before the parcel moves, so the
+  // step must satisfy (maxSpeed + acceleration * step) * step <= cfl
+  const float speed = maxSpeed + acceleration * settings.maxStep;
+  if (speed * settings.maxStep <= settings.cflTarget) {
+    return settings.maxStep;
+  }
+  // positive root of the quadratic, in a form that stays accurate when
+  // acceleration is small
+  const float root = std::sqrt(maxSpeed * maxSpeed +
+                               4.0F * acceleration * settings.cflTarget);
+  return std::max(2.0F * settings.cflTarget / (maxSpeed + root),
+                  settings.minStep);
+}
+
+size_t TimestepController::advance(
+    float frameDuration, const Liquid& fluid,
+    const std::function<void(float)>& step, float acceleration) const {
+  constexpr float HALF = 0.5F;
+
+  size_t substeps = 0;
+  float remaining = frameDuration;
+  while (remaining > 0.0F) {
+    float timeStep = stableStep(fluid.maxSpeed, acceleration);
+    if (timeStep >= remaining) {
+      timeStep = remaining;
+    } else if (timeStep > HALF * remaining) {
+      // split what is left evenly rather than end on a sliver of a step
+      timeStep = HALF * remaining;
+    }
+
+    step(timeStep);
+    remaining -= timeStep;
+    ++substeps;
+  }
+  return substeps;
+}
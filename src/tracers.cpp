@@ -0,0 +1,188 @@
+#include "tracers.hpp"
+
+#include "parallel.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr std::array<char, 8> TRAJECTORY_MAGIC = {'F', 'S', 'T', 'R',
+                                                  'A', 'J', '0', '1'};
+
+// tracers advected per batch, sized so the scratch stays in cache
+constexpr size_t ADVECT_BATCH = 256;
+
+template <typename T>
+void writeValue(std::ofstream& file, const T& value) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+}  // namespace
+
+void TracerSystem::seedBox(const Vec3& lower, const Vec3& upper,
+                           size_t count, uint32_t seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> unit(0.0F, 1.0F);
+
+  for (size_t i = 0; i < count; ++i) {
+    px.push_back(lower.x + (upper.x - lower.x) * unit(gen));
+    py.push_back(lower.y + (upper.y - lower.y) * unit(gen));
+    pz.push_back(lower.z + (upper.z - lower.z) * unit(gen));
+  }
+}
+
+void TracerSystem::advect(const Grid3D& grid, const Field<Vec3>& velocity,
+                          float timeStep) {
+  constexpr float HALF = 0.5F;
+  const float upperX = static_cast<float>(grid.nx - 1);
+  const float upperY = static_cast<float>(grid.ny - 1);
+  const float upperZ = static_cast<float>(grid.nz - 1);
+
+  const size_t batches = (size() + ADVECT_BATCH - 1) / ADVECT_BATCH;
+  parallelFor(batches, [&](size_t first, size_t last) {
+    std::array<float, ADVECT_BATCH> mx{}, my{}, mz{};
+    std::array<Vec3, ADVECT_BATCH> vel{};
+
+    for (size_t b = first; b < last; ++b) {
+      const size_t begin = b * ADVECT_BATCH;
+      const size_t n = std::min(ADVECT_BATCH, size() - begin);
+
+      trilinearInterpolateBatch(grid, velocity, &px[begin], &py[begin],
+                                &pz[begin], n, vel.data());
+      for (size_t i = 0; i < n; ++i) {
+        mx[i] = px[begin + i] + vel[i].x * (HALF * timeStep);
+        my[i] = py[begin + i] + vel[i].y * (HALF * timeStep);
+        mz[i] = pz[begin + i] + vel[i].z * (HALF * timeStep);
+      }
+
+      trilinearInterpolateBatch(grid, velocity, mx.data(), my.data(),
+                                mz.data(), n, vel.data());
+      for (size_t i = 0; i < n; ++i) {
+        px[begin + i] =
+            std::clamp(px[begin + i] + vel[i].x * timeStep, 0.0F, upperX);
+        py[begin + i] =
+            std::clamp(py[begin + i] + vel[i].y * timeStep, 0.0F, upperY);
+        pz[begin + i] =
+            std::clamp(pz[begin + i] + vel[i].z * timeStep, 0.0F, upperZ);
+      }
+    }
+  });
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string& path,
+                                   size_t count, size_t bufferCount)
+    : file(path, std::ios::binary | std::ios::trunc),
+      tracerCount(count),
+      filled(bufferCount),
+      spare(bufferCount) {
+  if (!file.is_open()) {
+    throw std::runtime_error("Cannot open trajectory file: " + path);
+  }
+
+  file.write(TRAJECTORY_MAGIC.data(), TRAJECTORY_MAGIC.size());
+  writeValue(file, FORMAT_VERSION);
+  writeValue(file, uint32_t{0});
+  writeValue(file, static_cast<uint64_t>(tracerCount));
+  if (!file) {
+    throw std::runtime_error("Cannot write trajectory file: " + path);
+  }
+
+  for (size_t i = 0; i < bufferCount; ++i) {
+    auto chunk = std::make_unique<Chunk>();
+    chunk->positions.resize(3 * tracerCount);
+    spare.push(std::move(chunk));
+  }
+  writer = std::thread([this] { writeLoop(); });
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+  try {
+    close();
+  } catch (...) {
+    // a destructor cannot report write errors; call close() to see them
+  }
+}
+
+void TrajectoryWriter::close() {
+  if (closed) return;
+  closed = true;
+
+  filled.close();
+  writer.join();
+  rethrowError();
+}
+
+void TrajectoryWriter::rethrowError() {
+  const std::lock_guard<std::mutex> lock(errorMutex);
+  if (error) std::rethrow_exception(error);
+}
+
+void TrajectoryWriter::record(size_t step, float time,
+                              const TracerSystem& tracers) {
+  if (tracers.size() != tracerCount) {
+    throw std::runtime_error("Tracer count changed while recording");
+  }
+  rethrowError();
+
+  // the writer closes the spare queue when it fails, so this cannot block
+  // on a thread that has stopped
+  std::optional<std::unique_ptr<Chunk>> chunk = spare.pop();
+  if (!chunk) {
+    rethrowError();
+    throw std::runtime_error("Trajectory writer is closed");
+  }
+
+  (*chunk)->step = step;
+  (*chunk)->time = time;
+  const size_t bytes = tracerCount * sizeof(float);
+  float* out = (*chunk)->positions.data();
+  std::memcpy(out, tracers.px.data(), bytes);
+  std::memcpy(out + tracerCount, tracers.py.data(), bytes);
+  std::memcpy(out + 2 * tracerCount, tracers.pz.data(), bytes);
+  filled.push(std::move(*chunk));
+}
+
+void TrajectoryWriter::writeLoop() {
+  try {
+    while (auto chunk = filled.pop()) {
+      writeValue(file, (*chunk)->step);
+      writeValue(file, (*chunk)->time);
+      writeValue(file, static_cast<uint32_t>(tracerCount));
+      file.write(
+          // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+          reinterpret_cast<const char*>((*chunk)->positions.data()),
+          static_cast<std::streamsize>((*chunk)->positions.size() *
+                                       sizeof(float)));
+      if (!file) {
+        throw std::runtime_error("Cannot write trajectory chunk");
+      }
+      spare.push(std::move(*chunk));
+    }
+    file.flush();
+    if (!file) {
+      throw std::runtime_error("Cannot flush trajectory file");
+    }
+  } catch (...) {
+    {
+      const std::lock_guard<std::mutex> lock(errorMutex);
+      error = std::current_exception();
+    }
+    // release a recorder waiting for a buffer, and drop what is queued
+    spare.close();
+    while (filled.pop()) {
+    }
+  }
+}
@@ -0,0 +1,152 @@
+#include "vti_writer.hpp"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "checkpoint.hpp"
+#include "output_region.hpp"
+#include "snapshot.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct VtiArray {
+  const char* name;
+  size_t components;
+  std::vector<iovec> data;  // x-fastest values, possibly in pieces
+  uint64_t bytes;
+};
+
+const char* hostByteOrder() {
+  const uint16_t probe = 1;
+  uint8_t first = 0;
+  std::memcpy(&first, &probe, 1);
+  return first == 1 ? "LittleEndian" : "BigEndian";
+}
+
+template <typename T>
+iovec view(const T* data, size_t count) {
+  // writev only reads it, but iovec wants a mutable pointer
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  return {const_cast<void*>(static_cast<const void*>(data)),
+          count * sizeof(T)};
+}
+
+// a whole linear field is already in VTK order, so its tiles are written
+// as they are; anything else is extracted into buffer
+template <typename T>
+VtiArray arrayOf(const char* name, size_t components, const Grid3D& grid,
+                 const FieldSnapshot<T>& field, const OutputRegion& region,
+                 std::vector<T>& buffer) {
+  VtiArray array{name, components, {}, region.cellCount() * sizeof(T)};
+  if (grid.layout == GridLayout::Linear && region.covers(grid)) {
+    for (size_t t = 0; t < field.tileCount(); ++t) {
+      array.data.push_back(view(field.tile(t).data(), field.tile(t).size()));
+    }
+    return array;
+  }
+
+  extractRegion(grid, field, region, buffer);
+  array.data.push_back(view(buffer.data(), buffer.size()));
+  return array;
+}
+
+}  // namespace
+
+VtiWriter::VtiWriter(std::string prefix, OutputRegion region)
+    : pathPrefix(std::move(prefix)), outputRegion(region) {}
+
+std::string VtiWriter::framePath(size_t step) const {
+  return pathPrefix + "_" + std::to_string(step) + ".vti";
+}
+
+void VtiWriter::write(const LiquidSnapshot& frame) {
+  const Grid3D& grid = frame.grid;
+  const OutputRegion region = outputRegion.clippedTo(grid);
+  const std::vector<VtiArray> arrays = {
+      arrayOf("velocity", 3, grid, frame.velocity, region, velocityBuffer),
+      arrayOf("density", 1, grid, frame.density, region, densityBuffer),
+      arrayOf("pressure", 1, grid, frame.pressure, region, pressureBuffer)};
+
+  const std::array<size_t, 3> cells = region.extent();
+  const std::string extent = "0 " + std::to_string(cells[0]) + " 0 " +
+                             std::to_string(cells[1]) + " 0 " +
+                             std::to_string(cells[2]);
+  const std::string spacing = std::to_string(region.stride);
+  std::string head = std::string("<?xml version=\"1.0\"?>\n") +
+                     "<VTKFile type=\"ImageData\" version=\"1.0\" "
+                     "byte_order=\"" +
+                     hostByteOrder() +
+                     "\" header_type=\"UInt64\">\n"
+                     "  <ImageData WholeExtent=\"" +
+                     extent +
+                     "\" Origin=\"" + std::to_string(region.begin[0]) +
+                     " " + std::to_string(region.begin[1]) + " " +
+                     std::to_string(region.begin[2]) + "\" Spacing=\"" +
+                     spacing + " " + spacing + " " + spacing +
+                     "\">\n"
+                     "    <Piece Extent=\"" +
+                     extent +
+                     "\">\n"
+                     "      <CellData Scalars=\"density\" "
+                     "Vectors=\"velocity\">\n";
+  // each appended block is a UInt64 byte count followed by the values
+  uint64_t offset = 0;
+  for (const VtiArray& array : arrays) {
+    head += "        <DataArray type=\"Float32\" Name=\"" +
+            std::string(array.name) + "\" NumberOfComponents=\"" +
+            std::to_string(array.components) +
+            "\" format=\"appended\" offset=\"" + std::to_string(offset) +
+            "\"/>\n";
+    offset += sizeof(uint64_t) + array.bytes;
+  }
+  head +=
+      "      </CellData>\n"
+      "    </Piece>\n"
+      "  </ImageData>\n"
+      "  <AppendedData encoding=\"raw\">\n"
+      "_";
+  std::string tail =
+      "\n"
+      "  </AppendedData>\n"
+      "</VTKFile>\n";
+
+  std::vector<uint64_t> counts;
+  counts.reserve(arrays.size());
+  std::vector<iovec> buffers;
+  buffers.push_back({head.data(), head.size()});
+  for (const VtiArray& array : arrays) {
+    counts.push_back(array.bytes);
+    buffers.push_back({&counts.back(), sizeof(uint64_t)});
+    buffers.insert(buffers.end(), array.data.begin(), array.data.end());
+  }
+  buffers.push_back({tail.data(), tail.size()});
+
+  const std::string path = framePath(frame.step);
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot create " + path + ": " +
+                             std::strerror(errno));
+  }
+  try {
+    writeAll(fd, buffers);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  if (close(fd) != 0) {
+    throw std::runtime_error("Cannot close " + path + ": " +
+                             std::strerror(errno));
+  }
+}
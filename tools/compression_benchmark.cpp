@@ -0,0 +1,111 @@
+#include "block_compression.hpp"
+#include "field.hpp"
+#include "sim_config.hpp"
+#include "simulation.hpp"
+#include "vec3.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+struct CompressionBenchmark {
+  double ratio;       // raw cell bytes over compressed bytes
+  double encodeMBps;  // raw megabytes per second
+  double decodeMBps;
+  double maxError;  // largest absolute error of any component
+};
+
+double largestError(float a, float b) {
+  return std::fabs(static_cast<double>(a) - static_cast<double>(b));
+}
+
+double largestError(const Vec3& a, const Vec3& b) {
+  return std::max({largestError(a.x, b.x), largestError(a.y, b.y),
+                   largestError(a.z, b.z)});
+}
+
+template <typename T>
+CompressionBenchmark benchmarkBlocks(const Grid3D& grid,
+                                     const Field<T>& field, float tolerance) {
+  using Clock = std::chrono::steady_clock;
+  constexpr double BYTES_PER_MB = 1.0e6;
+
+  const auto start = Clock::now();
+  const std::vector<uint8_t> encoded = compressBlocks(grid, field, tolerance);
+  const auto encodedAt = Clock::now();
+  Field<T> decoded(field.get_allocator());
+  decompressBlocks(grid, encoded, decoded);
+  const auto decodedAt = Clock::now();
+
+  double maxError = 0.0;
+  for (size_t z = 0; z < grid.nz; ++z) {
+    for (size_t y = 0; y < grid.ny; ++y) {
+      for (size_t x = 0; x < grid.nx; ++x) {
+        const size_t index = grid.offset(x, y, z);
+        maxError =
+            std::max(maxError, largestError(field[index], decoded[index]));
+      }
+    }
+  }
+
+  const double rawMB =
+      static_cast<double>(grid.cellCount() * sizeof(T)) / BYTES_PER_MB;
+  const std::chrono::duration<double> encodeTime = encodedAt - start;
+  const std::chrono::duration<double> decodeTime = decodedAt - encodedAt;
+  return {rawMB * BYTES_PER_MB / static_cast<double>(encoded.size()),
+          rawMB / encodeTime.count(), rawMB / decodeTime.count(), maxError};
+}
+
+void printBenchmark(const char* name, float tolerance,
+                    const CompressionBenchmark& result) {
+  std::cout << name << " at " << tolerance << ": ratio " << result.ratio
+            << ", encode " << result.encodeMBps << " MB/s, decode "
+            << result.decodeMBps << " MB/s, max error " << result.maxError
+            << "\n";
+}
+
+}  // namespace
+
+// fluidsim_compression [config file] [key=value ...]
+//
+// runs the configured simulation headless for its frames, then reports what
+// the block codec (output_tolerance > 0 when recording) makes of the final
+// density and velocity: at output_tolerance when it is set, otherwise at a
+// few tolerances to choose from
+int main(int argc, char** argv) {
+  try {
+    SimConfig config = parseCommandLine(argc, argv);
+    config.headless = true;
+    config.printSlices = false;
+
+    Simulation run(config);
+    for (size_t frame = 0; frame < config.frames; ++frame) {
+      run.advanceFrame();
+    }
+    run.finish();
+
+    constexpr std::array<float, 3> CANDIDATES = {1.0e-4F, 1.0e-3F, 1.0e-2F};
+    std::vector<float> tolerances(CANDIDATES.begin(), CANDIDATES.end());
+    if (config.outputTolerance > 0.0F) {
+      tolerances = {config.outputTolerance};
+    }
+    for (const float tolerance : tolerances) {
+      printBenchmark("density", tolerance,
+                     benchmarkBlocks(run.grid, run.fluid.density, tolerance));
+      printBenchmark("velocity", tolerance,
+                     benchmarkBlocks(run.grid, run.fluid.velocity, tolerance));
+    }
+  } catch (const std::exception& error) {
+    std::cerr << "error: " << error.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
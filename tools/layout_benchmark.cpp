@@ -0,0 +1,133 @@
+#include "sim_config.hpp"
+#include "simulation.hpp"
+#include "vector_math.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// hardware cache-miss counter for the calling thread, or nothing when the
+// kernel or a container refuses perf events
+class CacheMissCounter {
+ public:
+  CacheMissCounter() {
+    perf_event_attr attr{};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    descriptor = static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+  ~CacheMissCounter() {
+    if (available()) close(descriptor);
+  }
+  CacheMissCounter(const CacheMissCounter&) = delete;
+  CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+  CacheMissCounter(CacheMissCounter&&) = delete;
+  CacheMissCounter& operator=(CacheMissCounter&&) = delete;
+
+  [[nodiscard]] bool available() const { return descriptor >= 0; }
+
+  void start() const {
+    if (!available()) return;
+    ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+    ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  [[nodiscard]] uint64_t stop() const {
+    if (!available()) return 0;
+    ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t count = 0;
+    if (read(descriptor, &count, sizeof(count)) !=
+        static_cast<ssize_t>(sizeof(count))) {
+      return 0;
+    }
+    return count;
+  }
+
+ private:
+  int descriptor = -1;
+};
+
+const char* layoutName(GridLayout layout) {
+  switch (layout) {
+    case GridLayout::Tiled:
+      return "tiled";
+    case GridLayout::Morton:
+      return "morton";
+    case GridLayout::Linear:
+      break;
+  }
+  return "linear";
+}
+
+}  // namespace
+
+// fluidsim_layout [config file] [key=value ...]
+//
+// runs the configured simulation headless once per grid layout and reports
+// the time and cache misses per step of each, so the layout can be chosen
+// for a grid size and machine. the counter follows the calling thread, so
+// the kernels run on it alone
+int main(int argc, char** argv) {
+  try {
+    SimConfig config = parseCommandLine(argc, argv);
+    config.headless = true;
+    config.printSlices = false;
+    config.sharedFrames = false;
+    config.threads = 1;
+
+    const CacheMissCounter counter;
+    if (!counter.available()) {
+      std::cerr << "cache misses unavailable: " << std::strerror(errno)
+                << "\n";
+    }
+
+    using Clock = std::chrono::steady_clock;
+    constexpr std::array<GridLayout, 3> LAYOUTS = {
+        GridLayout::Linear, GridLayout::Tiled, GridLayout::Morton};
+    for (const GridLayout layout : LAYOUTS) {
+      config.layout = layout;
+      Simulation run(config);
+
+      counter.start();
+      const auto start = Clock::now();
+      for (size_t frame = 0; frame < config.frames; ++frame) {
+        run.advanceFrame();
+      }
+      const std::chrono::duration<double> elapsed = Clock::now() - start;
+      const uint64_t misses = counter.stop();
+      run.finish();
+
+      const double steps =
+          static_cast<double>(std::max<size_t>(run.step(), 1));
+      const double cells = static_cast<double>(run.grid.cellCount());
+      std::cout << layoutName(layout) << ": "
+                << elapsed.count() * 1.0e3 / steps << " ms/step, "
+                << cells * steps / elapsed.count() / 1.0e6 << " Mcells/s";
+      if (counter.available()) {
+        std::cout << ", " << static_cast<double>(misses) / steps
+                  << " cache misses/step";
+      }
+      std::cout << "\n";
+    }
+  } catch (const std::exception& error) {
+    std::cerr << "error: " << error.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
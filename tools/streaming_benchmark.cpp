@@ -0,0 +1,125 @@
+#include "field.hpp"
+#include "sim_config.hpp"
+#include "simulation.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+struct StreamingBenchmark {
+  double msPerStep;
+  double peakMB;  // resident set high-water mark during the steps
+};
+
+constexpr double BYTES_PER_MB = 1.0e6;
+
+// restarts the resident set high-water mark at the current size, so each
+// run reports its own peak
+void resetPeakResident() {
+  std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+double peakResidentMB() {
+  std::ifstream status("/proc/self/status");
+  for (std::string line; std::getline(status, line);) {
+    if (line.rfind("VmHWM:", 0) == 0) {
+      constexpr double KB_PER_MB = 1.0e3;
+      return std::stod(line.substr(line.find_first_of("0123456789"))) /
+             KB_PER_MB;
+    }
+  }
+  return 0.0;
+}
+
+StreamingBenchmark benchmarkRun(Simulation& run, size_t frames) {
+  using Clock = std::chrono::steady_clock;
+  resetPeakResident();
+  const auto start = Clock::now();
+  for (size_t frame = 0; frame < frames; ++frame) {
+    run.advanceFrame();
+  }
+  const std::chrono::duration<double> elapsed = Clock::now() - start;
+  const double steps = static_cast<double>(std::max<size_t>(run.step(), 1));
+  return {elapsed.count() * 1.0e3 / steps, peakResidentMB()};
+}
+
+void printBenchmark(const char* name, const StreamingBenchmark& result) {
+  std::cout << name << ": " << result.msPerStep << " ms/step, peak resident "
+            << result.peakMB << " MB\n";
+}
+
+}  // namespace
+
+// fluidsim_streaming --dir path [--slab n] [config file] [key=value ...]
+//
+// runs the configured simulation headless with its fields mapped from files
+// in path and streamed in slabs of n z-planes (8 by default), then again
+// from the heap when the fields fit in half of physical memory, and
+// reports the time and peak resident memory per run. size the grid past
+// physical memory to see the out-of-core mode keep its working set bounded
+int main(int argc, char** argv) {
+  SimConfig config;
+  auto storage = std::make_shared<FieldStorage>();
+  storage->slabDepth = 8;
+
+  try {
+    for (int i = 1; i < argc; ++i) {
+      const std::string argument = argv[i];
+      const size_t equals = argument.find('=');
+      if ((argument == "--dir" || argument == "--slab") && i + 1 < argc) {
+        const std::string value = argv[++i];
+        if (argument == "--dir") {
+          storage->directory = value;
+        } else {
+          storage->slabDepth = static_cast<size_t>(std::stoul(value));
+        }
+      } else if (argument.rfind("--", 0) == 0) {
+        throw std::runtime_error("unknown option " + argument);
+      } else if (equals == std::string::npos) {
+        loadConfig(argument, config);
+      } else {
+        setConfigValue(config, argument.substr(0, equals),
+                       argument.substr(equals + 1));
+      }
+    }
+    if (storage->directory.empty()) {
+      throw std::runtime_error("--dir is required");
+    }
+    config.headless = true;
+    config.printSlices = false;
+    config.sharedFrames = false;
+
+    double fieldMB = 0.0;
+    {
+      Simulation mapped(config, storage);
+      fieldMB = static_cast<double>(mapped.fluid.fields.bytesPerElement() *
+                                    mapped.grid.size()) /
+                BYTES_PER_MB;
+      std::cout << "fields: " << fieldMB << " MB\n";
+      printBenchmark("mapped", benchmarkRun(mapped, config.frames));
+    }
+
+    const double physicalMB = static_cast<double>(sysconf(_SC_PHYS_PAGES)) *
+                              static_cast<double>(sysconf(_SC_PAGESIZE)) /
+                              BYTES_PER_MB;
+    if (fieldMB > physicalMB / 2.0) {
+      std::cout << "heap: skipped, physical memory is " << physicalMB
+                << " MB\n";
+    } else {
+      Simulation heap(config);
+      printBenchmark("heap", benchmarkRun(heap, config.frames));
+    }
+  } catch (const std::exception& error) {
+    std::cerr << "error: " << error.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "sim_config.hpp"
+#include "sweep.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// fluidsim_sweep [config file] [key=value ...] [--jobs n] [--out file]
+//
+// a value holding several space-separated entries is swept, e.g.
+//   fluidsim_sweep frames=200 viscosity="1e-6 1e-5 1e-4" nx="64 128"
+// runs six headless simulations, as many at once as the machine has
+// cores for, and writes one CSV row per run
+int main(int argc, char** argv) {
+  SimConfig base;
+  base.headless = true;
+  base.printSlices = false;
+  base.sharedFrames = false;
+  // the runs themselves are the parallelism unless a config says otherwise
+  base.threads = 1;
+
+  std::vector<SweepAxis> axes;
+  size_t jobs = 0;
+  std::string csvPath = "sweep.csv";
+
+  try {
+    for (int i = 1; i < argc; ++i) {
+      const std::string argument = argv[i];
+      const size_t equals = argument.find('=');
+      if ((argument == "--jobs" || argument == "--out") && i + 1 < argc) {
+        const std::string value = argv[++i];
+        if (argument == "--out") {
+          csvPath = value;
+        } else {
+          jobs = static_cast<size_t>(std::stoul(value));
+        }
+      } else if (argument.rfind("--", 0) == 0) {
+        throw std::runtime_error("unknown option " + argument);
+      } else if (equals == std::string::npos) {
+        loadConfig(argument, base);
+      } else {
+        const std::string key = argument.substr(0, equals);
+        std::istringstream values(argument.substr(equals + 1));
+        SweepAxis axis{key, {}};
+        for (std::string value; values >> value;) {
+          axis.values.push_back(value);
+        }
+        if (axis.values.size() == 1) {
+          setConfigValue(base, key, axis.values.front());
+        } else {
+          axes.push_back(std::move(axis));
+        }
+      }
+    }
+
+    if (jobs == 0) {
+      const size_t cores =
+          std::max<size_t>(1, std::thread::hardware_concurrency());
+      const size_t perRun = base.threads == 0 ? cores : base.threads;
+      jobs = std::max<size_t>(1, cores / perRun);
+    }
+
+    const std::vector<SweepRun> runs = expandSweep(base, axes);
+    std::cerr << runs.size() << " runs, " << jobs << " at a time\n";
+    const std::vector<SweepResult> results = runSweep(runs, jobs, std::cerr);
+
+    std::ofstream csv(csvPath);
+    if (!csv.is_open()) {
+      throw std::runtime_error("Cannot write " + csvPath);
+    }
+    writeSweepCsv(csv, axes, runs, results);
+
+    const bool allOk = std::all_of(results.begin(), results.end(),
+                                   [](const SweepResult& r) { return r.ok; });
+    return allOk ? 0 : 1;
+  } catch (const std::exception& error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+}